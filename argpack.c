@@ -0,0 +1,96 @@
+/*
+ * argpack.c - pre-split command lines
+ *
+ * Copyright (c) 2004 by Tim Adye <T.J.Adye@rl.ac.uk>.
+ * Permission to use, copy, modify, and distribute this software and its
+ * documentation for any purpose and without fee is hereby granted,
+ * provided that the above copyright notice appears in all copies.
+ * If this software is included in another package, acknowledgement
+ * in the supporting documentation is requested, but not required.
+ * This software is provided "as is" without express or implied warranty.
+ */
+
+/* A packed exec request is argpack_magic, followed by one entry per argument,
+ * working directory, or environment setting:
+ *   1 byte   type (ARGPACK_ARG, ARGPACK_CWD, or ARGPACK_ENV)
+ *   4 bytes  value length, little-endian, including a terminating '\0'
+ *   value
+ * so the receiver can use the values in place, without any unescaping.
+ * The magic starts with '\0', so cannot be confused with a text request.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "argpack.h"
+
+static const char argpack_magic[ARGPACK_HDR]= "\0CYGARGV";
+
+
+void
+argpack_init (struct argpack* p)
+{
+  p->data= NULL;
+  p->ldata= p->maxdata= 0;
+}
+
+
+/* Append an entry. Returns 0 if out of memory. */
+int
+argpack_add (struct argpack* p, int type, const char* value)
+{
+  size_t lv= strlen (value) + 1, need;
+  unsigned char* e;
+
+  if (!p->ldata) need= ARGPACK_HDR + 5 + lv;
+  else           need= p->ldata    + 5 + lv;
+  if (need > p->maxdata) {
+    size_t n= p->maxdata ? 2*p->maxdata : 1024;
+    char* d;
+    while (n < need) n *= 2;
+    if (!(d= (char*) realloc (p->data, n))) return 0;
+    p->data= d;
+    p->maxdata= n;
+  }
+  if (!p->ldata) {
+    memcpy (p->data, argpack_magic, ARGPACK_HDR);
+    p->ldata= ARGPACK_HDR;
+  }
+  e= (unsigned char*) p->data + p->ldata;
+  e[0]= type;
+  e[1]=  lv        & 0xff;
+  e[2]= (lv >>  8) & 0xff;
+  e[3]= (lv >> 16) & 0xff;
+  e[4]= (lv >> 24) & 0xff;
+  memcpy (e+5, value, lv);
+  p->ldata= need;
+  return 1;
+}
+
+
+/* Is DATA a packed request? */
+int
+argpack_is (const void* data, size_t ldata)
+{
+  return ldata >= ARGPACK_HDR && !memcmp (data, argpack_magic, ARGPACK_HDR);
+}
+
+
+/* Return the type of the entry at *POS (start at ARGPACK_HDR), setting *VALUE
+ * to point to its value in DATA, and advance *POS to the next entry.
+ * Returns 0 at the end, or -1 if DATA is malformed.
+ */
+int
+argpack_next (const char* data, size_t ldata, size_t* pos, const char** value)
+{
+  const unsigned char* e= (const unsigned char*) data + *pos;
+  size_t lv;
+
+  if (*pos >= ldata || !e[0]) return 0;     /* allow trailing '\0' padding */
+  if (ldata - *pos < 5) return -1;
+  lv= e[1] | (e[2] << 8) | ((size_t) e[3] << 16) | ((size_t) e[4] << 24);
+  if (!lv || lv > ldata - *pos - 5 || e[4+lv] != '\0') return -1;
+  *value= (const char*) e+5;
+  *pos += 5 + lv;
+  return e[0];
+}
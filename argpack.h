@@ -0,0 +1,33 @@
+/*
+ * argpack.h - pre-split command lines
+ *
+ * Copyright (c) 2004 by Tim Adye <T.J.Adye@rl.ac.uk>.
+ * Permission to use, copy, modify, and distribute this software and its
+ * documentation for any purpose and without fee is hereby granted,
+ * provided that the above copyright notice appears in all copies.
+ * If this software is included in another package, acknowledgement
+ * in the supporting documentation is requested, but not required.
+ * This software is provided "as is" without express or implied warranty.
+ */
+
+#ifndef ARGPACK_H
+#define ARGPACK_H
+
+#define ARGPACK_HDR 8         /* size of magic header */
+
+/* Entry types */
+#define ARGPACK_ARG 'a'       /* command argument (including request options) */
+#define ARGPACK_CWD 'c'       /* working directory */
+#define ARGPACK_ENV 'e'       /* environment setting, NAME=VALUE */
+
+struct argpack {
+  char*  data;
+  size_t ldata, maxdata;
+};
+
+extern void argpack_init(struct argpack* p);
+extern int  argpack_add(struct argpack* p, int type, const char* value);
+extern int  argpack_is(const void* data, size_t ldata);
+extern int  argpack_next(const char* data, size_t ldata, size_t* pos, const char** value);
+
+#endif /* ARGPACK_H */
@@ -0,0 +1,24 @@
+/*
+ * bench.c - shared helpers for the benchmark programs
+ *
+ * Copyright (c) 2004 by Tim Adye <T.J.Adye@rl.ac.uk>.
+ * Permission to use, copy, modify, and distribute this software and its
+ * documentation for any purpose and without fee is hereby granted,
+ * provided that the above copyright notice appears in all copies.
+ * If this software is included in another package, acknowledgement
+ * in the supporting documentation is requested, but not required.
+ * This software is provided "as is" without express or implied warranty.
+ */
+
+#include <time.h>
+
+#include "bench.h"
+
+/* Monotonic time, in seconds */
+double
+bench_now(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + 1e-9 * t.tv_nsec;
+}
@@ -0,0 +1,18 @@
+/*
+ * bench.h - shared helpers for the benchmark programs
+ *
+ * Copyright (c) 2004 by Tim Adye <T.J.Adye@rl.ac.uk>.
+ * Permission to use, copy, modify, and distribute this software and its
+ * documentation for any purpose and without fee is hereby granted,
+ * provided that the above copyright notice appears in all copies.
+ * If this software is included in another package, acknowledgement
+ * in the supporting documentation is requested, but not required.
+ * This software is provided "as is" without express or implied warranty.
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+extern double bench_now(void);
+
+#endif /* BENCH_H */
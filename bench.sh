@@ -0,0 +1,10 @@
+#!/bin/sh
+# Build and run the benchmarks (see README.md).
+test $# -eq 0 && set -- -O2 -Wall
+set -ex
+${CC:-gcc} "$@" -o bench_spawn   bench_spawn.c bench.c execpath.c
+./bench_spawn
+${CC:-gcc} "$@" -o bench_shmring bench_shmring.c bench.c shmring.c -lpthread
+./bench_shmring
+${CC:-gcc} "$@" -o bench_argpack bench_argpack.c bench.c argpack.c escstr.c
+./bench_argpack
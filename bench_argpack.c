@@ -0,0 +1,117 @@
+/*
+ * bench_argpack.c - time text and packed exec requests
+ *
+ * Copyright (c) 2004 by Tim Adye <T.J.Adye@rl.ac.uk>.
+ * Permission to use, copy, modify, and distribute this software and its
+ * documentation for any purpose and without fee is hereby granted,
+ * provided that the above copyright notice appears in all copies.
+ * If this software is included in another package, acknowledgement
+ * in the supporting documentation is requested, but not required.
+ * This software is provided "as is" without express or implied warranty.
+ */
+
+/* Usage: bench_argpack [-n COUNT] [COMMAND [ARGS...]]
+ * Encodes COMMAND (default, an 8-word xterm command line) COUNT times in
+ * each request format, and decodes it again as cyglauncher does:
+ *   text    escargs() in the client, then the server's copy and splitargs()
+ *   packed  argpack_add() in the client, then the server's copy and
+ *           argpack_next()
+ * and prints the time per request.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+#include "argpack.h"
+#include "escstr.h"
+
+#define MAXARGS 1024
+
+static const char* volatile sink;   /* so the decoded arguments are used */
+
+/* Returns the number of arguments decoded, and the request size in *LREQ */
+static int
+text_request(size_t argc, char* const argv[], size_t* lreq)
+{
+  char *args[MAXARGS], *data, *argbuf;
+  const char* s;
+  size_t l;
+  int n;
+
+  s= escargs(argc, argv);              /* client */
+  l= strlen(s)+1;
+  data= (char*) malloc(l);             /* server: the copy of the DDE data */
+  memcpy(data, s, l);
+  argbuf= (char*) malloc(l);
+  n= splitargs(data, args, MAXARGS, argbuf, l);
+  if (n > 0) sink= args[n-1];
+  free(argbuf);
+  free(data);
+  *lreq= l;
+  return n;
+}
+
+static int
+packed_request(size_t argc, char* const argv[], size_t* lreq)
+{
+  const char *args[MAXARGS], *v;
+  struct argpack pk;
+  size_t i, pos;
+  char* data;
+  int n= 0;
+
+  argpack_init(&pk);                   /* client */
+  for (i= 0; i<argc; i++)
+    if (!argpack_add(&pk, ARGPACK_ARG, argv[i])) return -1;
+  data= (char*) malloc(pk.ldata);      /* server */
+  memcpy(data, pk.data, pk.ldata);
+  for (pos= ARGPACK_HDR; argpack_next(data, pk.ldata, &pos, &v) > 0 && n < MAXARGS;)
+    args[n++]= v;
+  if (n > 0) sink= args[n-1];
+  free(data);
+  free(pk.data);
+  *lreq= pk.ldata;
+  return n;
+}
+
+int
+main(int argc, char* argv[])
+{
+  static char* default_cmd[]= { "xterm", "-display", ":0", "-title", "build log",
+                                "-e", "tail", "/home/u/My Documents/build.log", NULL };
+  char** cmd= default_cmd;
+  size_t ncmd, lreq;
+  long i, n= 1000000;
+  double t;
+
+  if (argc > 2 && !strcmp(argv[1], "-n")) {
+    n= atol(argv[2]);
+    argc -= 2;
+    argv += 2;
+  }
+  if (argc > 1) cmd= argv+1;
+  if (n <= 0) {
+    fprintf(stderr, "Usage: bench_argpack [-n COUNT] [COMMAND [ARGS...]]\n");
+    return 2;
+  }
+  for (ncmd= 0; cmd[ncmd]; ncmd++) ;
+
+  t= bench_now();
+  for (i= 0; i<n; i++)
+    if (text_request(ncmd, cmd, &lreq) != (int) ncmd) {
+      fprintf(stderr, "text request did not decode\n");
+      return 1;
+    }
+  printf("%-6s %8.1f ns per request, %4lu bytes\n", "text", 1e9 * (bench_now() - t) / n, (unsigned long) lreq);
+
+  t= bench_now();
+  for (i= 0; i<n; i++)
+    if (packed_request(ncmd, cmd, &lreq) != (int) ncmd) {
+      fprintf(stderr, "packed request did not decode\n");
+      return 1;
+    }
+  printf("%-6s %8.1f ns per request, %4lu bytes\n", "packed", 1e9 * (bench_now() - t) / n, (unsigned long) lreq);
+  return 0;
+}
@@ -0,0 +1,160 @@
+/*
+ * bench_shmring.c - time requests through the shared-memory ring and a socket
+ *
+ * Copyright (c) 2004 by Tim Adye <T.J.Adye@rl.ac.uk>.
+ * Permission to use, copy, modify, and distribute this software and its
+ * documentation for any purpose and without fee is hereby granted,
+ * provided that the above copyright notice appears in all copies.
+ * If this software is included in another package, acknowledgement
+ * in the supporting documentation is requested, but not required.
+ * This software is provided "as is" without express or implied warranty.
+ */
+
+/* Usage: bench_shmring [-n COUNT]
+ * Sends COUNT requests to a server process, and waits for each one to be
+ * acknowledged, first through a shmring, then through a Unix-domain
+ * datagram socketpair. The server does nothing with them, so this times
+ * just the IPC. Prints the mean, median, and 99th percentile round trip.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "bench.h"
+#include "shmring.h"
+
+static const char request[]= "xterm -display :0 -geometry 80x24 -e ssh somehost";
+static const char quit[]= "quit";
+
+static int
+cmp_double(const void* a, const void* b)
+{
+  double x= *(const double*) a, y= *(const double*) b;
+  return (x > y) - (x < y);
+}
+
+static void
+report(const char* what, double* times, long n)
+{
+  double sum= 0.0;
+  long i;
+  for (i= 0; i<n; i++) sum += times[i];
+  qsort(times, n, sizeof(*times), cmp_double);
+  printf("%-6s %8.2f us mean %8.2f us median %8.2f us 99%%\n", what,
+         1e6 * sum / n, 1e6 * times[n/2], 1e6 * times[n - 1 - n/100]);
+}
+
+static int stop= 0;
+
+static int
+ringHandler(const void* data, unsigned long ldata)
+{
+  if (ldata == sizeof(quit)-1 && !memcmp(data, quit, ldata)) stop= 1;
+  return SHMRING_OK;
+}
+
+static int
+bench_ring(double* times, long n)
+{
+  struct shmring* ring;
+  char name[64];
+  int ready[2];
+  char c;
+  pid_t pid;
+  long i;
+
+  snprintf(name, sizeof(name), "/cyglaunch-bench-%d", (int) getpid());
+  if (pipe(ready)) return 0;
+  if ((pid= fork()) == 0) {
+    if (!(ring= shmring_create(name))) {
+      perror("shmring_create");
+      _exit(1);
+    }
+    write(ready[1], "", 1);
+    while (!stop && shmring_wait(ring))
+      shmring_drain(ring, ringHandler);
+    shmring_close(ring);
+    _exit(0);
+  }
+  close(ready[1]);
+  if (pid == -1 || read(ready[0], &c, 1) != 1 || !(ring= shmring_open(name))) {
+    close(ready[0]);
+    return 0;
+  }
+  close(ready[0]);
+  for (i= 0; i<n; i++) {
+    double t= bench_now();
+    if (shmring_send(ring, request, sizeof(request)-1, 30000) != SHMRING_OK) {
+      perror("shmring_send");
+      break;
+    }
+    times[i]= bench_now() - t;
+  }
+  shmring_send(ring, quit, sizeof(quit)-1, 30000);
+  shmring_close(ring);
+  waitpid(pid, NULL, 0);
+  return i == n;
+}
+
+static int
+bench_socket(double* times, long n)
+{
+  char buf[SHMRING_DATA], status;
+  int fds[2];
+  pid_t pid;
+  ssize_t l;
+  long i;
+
+  if (socketpair(AF_UNIX, SOCK_DGRAM, 0, fds)) return 0;
+  if ((pid= fork()) == 0) {
+    close(fds[0]);
+    status= SHMRING_OK;
+    while ((l= recv(fds[1], buf, sizeof(buf), 0)) > 0) {
+      if (send(fds[1], &status, 1, 0) != 1) break;
+      if (l == sizeof(quit)-1 && !memcmp(buf, quit, l)) break;
+    }
+    _exit(0);
+  }
+  close(fds[1]);
+  if (pid == -1) return 0;
+  for (i= 0; i<n; i++) {
+    double t= bench_now();
+    if (send(fds[0], request, sizeof(request)-1, 0) < 0 || recv(fds[0], &status, 1, 0) != 1) {
+      perror("socket");
+      break;
+    }
+    times[i]= bench_now() - t;
+  }
+  send(fds[0], quit, sizeof(quit)-1, 0);
+  recv(fds[0], &status, 1, 0);
+  close(fds[0]);
+  waitpid(pid, NULL, 0);
+  return i == n;
+}
+
+int
+main(int argc, char* argv[])
+{
+  double* times;
+  long n= 100000;
+
+  if (argc > 2 && !strcmp(argv[1], "-n")) n= atol(argv[2]);
+  if (n <= 0) {
+    fprintf(stderr, "Usage: bench_shmring [-n COUNT]\n");
+    return 2;
+  }
+  times= (double*) malloc(n * sizeof(*times));
+  if (!bench_ring(times, n)) return 1;
+  report("ring", times, n);
+  if (!bench_socket(times, n)) return 1;
+  report("socket", times, n);
+  free(times);
+  return 0;
+}
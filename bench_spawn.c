@@ -0,0 +1,118 @@
+/*
+ * bench_spawn.c - time cyglauncher's ways of starting a child
+ *
+ * Copyright (c) 2004 by Tim Adye <T.J.Adye@rl.ac.uk>.
+ * Permission to use, copy, modify, and distribute this software and its
+ * documentation for any purpose and without fee is hereby granted,
+ * provided that the above copyright notice appears in all copies.
+ * If this software is included in another package, acknowledgement
+ * in the supporting documentation is requested, but not required.
+ * This software is provided "as is" without express or implied warranty.
+ */
+
+/* Usage: bench_spawn [-n COUNT] [COMMAND [ARGS...]]
+ * Starts COMMAND (default "true") COUNT times in each of these ways, and
+ * prints the time the server is busy per spawn:
+ *   fork   fork and exec, returning after the fork
+ *   wait   with a close-on-exec status pipe, waiting for the exec
+ *   check  check the command in the parent, then fork with a status pipe
+ *          that is read later (as cyglauncher does)
+ */
+
+#define _GNU_SOURCE  /* pipe2 */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/wait.h>
+
+#include "bench.h"
+#include "execpath.h"
+
+enum mode { MODE_FORK, MODE_WAIT, MODE_CHECK };
+static const char* const mode_names[]= { "fork", "wait", "check" };
+
+static void
+exec_child(int fd, char* const argv[])
+{
+  int err;
+  execvp(argv[0], argv);
+  err= errno;
+  if (fd >= 0) write(fd, &err, sizeof(err));
+  _exit(127);
+}
+
+/* Start ARGV, returning the exec status pipe (if any) in *FD */
+static pid_t
+spawn(enum mode mode, char* const argv[], int* fd)
+{
+  int fds[2], err= 0;
+  struct pollfd pfd;
+  pid_t pid;
+
+  *fd= -1;
+  if (mode == MODE_CHECK && !execpath_check(argv[0], getenv("PATH"), NULL)) return -1;
+  if (mode != MODE_FORK && pipe2(fds, O_CLOEXEC | (mode == MODE_CHECK ? O_NONBLOCK : 0))) return -1;
+  if ((pid= fork()) == 0) {
+    if (mode != MODE_FORK) close(fds[0]);
+    exec_child(mode != MODE_FORK ? fds[1] : -1, argv);
+  }
+  if (mode == MODE_FORK) return pid;
+  close(fds[1]);
+  if (mode == MODE_CHECK) {
+    *fd= fds[0];
+    return pid;
+  }
+  pfd.fd= fds[0];
+  pfd.events= POLLIN;
+  while (poll(&pfd, 1, -1) < 0 && errno == EINTR) ;
+  if (read(fds[0], &err, sizeof(err)) == sizeof(err)) pid= -1;
+  close(fds[0]);
+  errno= err;
+  return pid;
+}
+
+int
+main(int argc, char* argv[])
+{
+  static char* default_cmd[]= { "true", NULL };
+  char** cmd= default_cmd;
+  long i, n= 1000;
+  int m, fd, err;
+  double t, busy;
+  pid_t pid;
+
+  if (argc > 2 && !strcmp(argv[1], "-n")) {
+    n= atol(argv[2]);
+    argc -= 2;
+    argv += 2;
+  }
+  if (argc > 1) cmd= argv+1;
+  if (n <= 0) {
+    fprintf(stderr, "Usage: bench_spawn [-n COUNT] [COMMAND [ARGS...]]\n");
+    return 2;
+  }
+  for (m= MODE_FORK; m <= MODE_CHECK; m++) {
+    busy= 0.0;
+    for (i= 0; i<n; i++) {
+      t= bench_now();
+      pid= spawn((enum mode) m, cmd, &fd);
+      busy += bench_now() - t;
+      if (pid == -1) {
+        perror(cmd[0]);
+        return 1;
+      }
+      /* reaping isn't timed: cyglauncher does it later, from its timer */
+      waitpid(pid, NULL, 0);
+      if (fd >= 0) {
+        if (read(fd, &err, sizeof(err)) == sizeof(err)) fprintf(stderr, "%s: exec failed\n", cmd[0]);
+        close(fd);
+      }
+    }
+    printf("%-6s %8.1f us per spawn\n", mode_names[m], 1e6 * busy / n);
+  }
+  return 0;
+}
@@ -14,10 +14,14 @@ m=${carch}-w64-mingw32-
 test $# -eq 0 && set -- -Wall
 set -x
 ${c}gcc "$@" -o escstr.o          -c escstr.c
+${c}gcc "$@" -o execpath.o        -c execpath.c
 ${m}gcc "$@" -o escstr-win.o      -c escstr.c                   -mwindows
+${c}gcc "$@" -o shmring.o         -c shmring.c
+${c}gcc "$@" -o trace.o           -c trace.c
+${c}gcc "$@" -o argpack.o         -c argpack.c
 ${m}gcc "$@" -o cyglaunch.exe        cyglaunch.c   escstr-win.o -mwindows -lshlwapi
-${c}gcc "$@" -o cyglaunch-cygwin.exe cyglaunch.c   escstr.o               -lshlwapi
-${c}gcc "$@" -o cyglauncher.exe      cyglauncher.c escstr.o
-rm escstr.o escstr-win.o
+${c}gcc "$@" -o cyglaunch-cygwin.exe cyglaunch.c   replay.c argpack.o escstr.o shmring.o trace.o -lshlwapi
+${c}gcc "$@" -o cyglauncher.exe      cyglauncher.c history.c prewarm.c argpack.o escstr.o execpath.o shmring.o trace.o
+rm argpack.o escstr.o execpath.o escstr-win.o shmring.o trace.o
 ${m}strip -p cyglaunch.exe
 ${c}strip -p cyglaunch-cygwin.exe cyglauncher.exe
@@ -11,7 +11,10 @@
  */
 
 #include <ctype.h>
+#include <errno.h>
+#include <limits.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include <time.h>
 #ifdef __CYGWIN__
@@ -21,15 +24,35 @@
 #include <shlwapi.h>
 
 #include "escstr.h"
+#ifdef __CYGWIN__
+#include "argpack.h"
+#include "shmring.h"
+#include "replay.h"
+#endif
 
-static const char ddeServiceName[]= "cyglaunch";
+static char ddeServiceName[64]= "cyglaunch";  /* "cyglaunch-INSTANCE" for a named instance */
 static const char cmd_envvar[]= "CYGLAUNCH_EXEC";  /* must be upper case because Cygwin converts DOS envvars to u/c */
+static const char instance_envvar[]= "CYGLAUNCH_INSTANCE";      /* default instance */
+static const char instances_envvar[]= "CYGLAUNCH_INSTANCES";    /* instances to spread commands over */
+static const char routes_envvar[]= "CYGLAUNCH_ROUTES";          /* COMMAND=INSTANCE,... */
+static const char server_instance_envvar[]= "CYGLAUNCHER_INSTANCE";
+static const char *instance= NULL, *optn= NULL;
 static const char cyglauncher_envvar[]= "CYGLAUNCHER_CMD";
 static const char cyglauncher_cmd[]= "cyglauncher-start";
 static const char *cyglauncher_args= NULL;
 static const char *prog= "cyglaunch";  /* replaced with argv[0] if known */
 static DWORD ddeInstance= 0;
-static int verbose= 0, opte= 0, opth= 0;
+static int verbose= 0, optd= 0, opte= 0, opth= 0, optr= 0, opts= 0, optx= 0;
+
+/* sendRing and sendCommand results when FAILOVER is set */
+#define SEND_BUSY   -2
+#define SEND_ABSENT -3
+#ifdef __CYGWIN__
+static int optF= 0;
+static const char *replay_file= NULL, *compare_file= NULL, *standin= NULL, *optC= NULL;
+static const char *optE[64];
+static size_t noptE= 0;
+#endif
 
 static HDDEDATA CALLBACK
 DdeServerProc (UINT uType, UINT uFmt, HCONV hConv, HSZ ddeTopic, HSZ ddeItem,
@@ -44,9 +67,11 @@ DdeServerProc (UINT uType, UINT uFmt, HCONV hConv, HSZ ddeTopic, HSZ ddeItem,
 #ifdef __CYGWIN__
 #define errmsg(...) (fprintf(stderr,__VA_ARGS__), fflush(stderr))
 #define dbgmsg(...) (verbose ? (fprintf(stdout,__VA_ARGS__), fflush(stdout)) : 0)
+#define outmsg(...) (fprintf(stdout,__VA_ARGS__), fflush(stdout))
 #else
 #define errmsg(...) (msgbox(0, __VA_ARGS__))
 #define dbgmsg(...) (verbose ? msgbox(1, __VA_ARGS__) : 0)
+#define outmsg(...) (msgbox(2, __VA_ARGS__))
 static int
 msgbox(int dbg, const char* fmt,...)
 {
@@ -56,7 +81,7 @@ msgbox(int dbg, const char* fmt,...)
   va_start(ap, fmt);
   n= vsnprintf(s, sizeof(s), fmt, ap);
   va_end(ap);
-  MessageBox(NULL, s, dbg ? "Debug" : NULL, 0);
+  MessageBox(NULL, s, dbg == 1 ? "Debug" : dbg == 2 ? prog : NULL, 0);
   return n;
 }
 #endif
@@ -115,6 +140,53 @@ perrorDde(const char* prefix, DWORD errnum)
 }
 
 
+#ifdef __CYGWIN__
+/* Convert packed request DATA to text, running the command with
+ * "env -C DIR NAME=VALUE..." if it has a working directory or environment.
+ * Returns NULL if it is too long.
+ */
+static const char*
+packed_text(const char* data, size_t ldata)
+{
+  char *args[1024], *envs[1024], *argv[2*1024+3];  /* + "env -C DIR" */
+  const char *v, *cwd= NULL;
+  size_t pos, nargs= 0, nenvs= 0, nopts, n= 0, i;
+  int type;
+
+  for (pos= ARGPACK_HDR; (type= argpack_next(data, ldata, &pos, &v)) > 0;) {
+    if      (type == ARGPACK_ARG && nargs < 1024) args[nargs++]= (char*) v;
+    else if (type == ARGPACK_ENV && nenvs < 1024) envs[nenvs++]= (char*) v;
+    else if (type == ARGPACK_CWD)                 cwd= v;
+  }
+  /* request options stay in front */
+  for (nopts= 0; nopts < nargs; nopts++) {
+    if (args[nopts][0] != '@' && args[nopts][0] != '{' && strcmp(args[nopts], "!")) break;
+  }
+  for (i= 0; i<nopts; i++) argv[n++]= args[i];
+  if (cwd || nenvs) {
+    argv[n++]= "env";
+    if (cwd) {
+      argv[n++]= "-C";
+      argv[n++]= (char*) cwd;
+    }
+    for (i= 0; i<nenvs; i++) argv[n++]= envs[i];
+  }
+  for (i= nopts; i<nargs; i++) argv[n++]= args[i];
+  return escargs(n, argv);
+}
+#endif
+
+/* The request as text, for messages and CYGLAUNCH_EXEC */
+static const char*
+cmdtext(const char* data, size_t ldata)
+{
+#ifdef __CYGWIN__
+  if (argpack_is(data, ldata)) return packed_text(data, ldata);
+#endif
+  return data;
+}
+
+
 static int
 start_cyglauncher(const char* cmd)
 {
@@ -127,7 +199,8 @@ start_cyglauncher(const char* cmd)
   char progpath[MAX_PATH+1], abscmd[MAX_PATH+1];
   const char* envcmd;
 
-  if (!SetEnvironmentVariable(cmd_envvar, cmd)) {
+  if (!SetEnvironmentVariable(cmd_envvar, cmd) ||
+      !SetEnvironmentVariable(server_instance_envvar, instance)) {
     perrorWin("SetEnvironmentVariable error", GetLastError());
     return 1;
   }
@@ -164,21 +237,46 @@ start_cyglauncher(const char* cmd)
     return 1;
   }
   free(cmdbuf);
-  if (!SetEnvironmentVariable(cmd_envvar, NULL))
+  if (!SetEnvironmentVariable(cmd_envvar, NULL) ||
+      !SetEnvironmentVariable(server_instance_envvar, NULL))
     perrorWin("SetEnvironmentVariable error (unset)", GetLastError());  /* not fatal */
   return 0;
 }
 
 
+/* Is the cyglauncher instance handling a request? It sets its
+ * "SERVICE-busy" event while it is, and a DDE connection would wait.
+ */
 static int
-sendCommand(const char* topic, const char* command)
+server_busy()
+{
+  char name[sizeof(ddeServiceName)+5];
+  HANDLE ev;
+  int busy;
+
+  snprintf(name, sizeof(name), "%s-busy", ddeServiceName);
+  if (!(ev= OpenEvent(SYNCHRONIZE, FALSE, name))) return 0;  /* not running */
+  busy= (WaitForSingleObject(ev, 0) == WAIT_OBJECT_0);
+  CloseHandle(ev);
+  return busy;
+}
+
+
+/* Send COMMAND to cyglauncher on TOPIC. If FAILOVER is set, returns
+ * SEND_ABSENT or SEND_BUSY, instead of starting cyglauncher or failing,
+ * if it is not running or is busy.
+ */
+static int
+sendCommand(const char* topic, const char* command, size_t lcommand, int failover)
 {
   HSZ ddeService, ddeTopic;
   HCONV ddeConv;
   HDDEDATA ddeData;
   HDDEDATA ddeReturn;
+  DWORD result= 0;
   UINT err;
 
+  if (failover && server_busy()) return SEND_BUSY;
   ddeService= DdeCreateStringHandle(ddeInstance, (LPTSTR) ddeServiceName, 0);
   ddeTopic=   DdeCreateStringHandle(ddeInstance, (LPTSTR) topic, 0);
   ddeConv= DdeConnect(ddeInstance, ddeService, ddeTopic, NULL);
@@ -187,8 +285,17 @@ sendCommand(const char* topic, const char* command)
     DdeFreeStringHandle(ddeInstance, ddeService);
     DdeFreeStringHandle(ddeInstance, ddeTopic);
     if (err == DMLERR_NO_CONV_ESTABLISHED) {
-      if (strcmp(topic, "exec") == 0) return start_cyglauncher(command);
+      if (failover) return SEND_ABSENT;
+      if (strcmp(topic, "exec") == 0) {
+        const char* text= cmdtext(command, lcommand);
+        if (!text) {
+          errmsg("%s: command or word too long\n", prog);
+          return 0;
+        }
+        return start_cyglauncher(text);
+      }
       if (strcmp(topic, "exit") == 0) return 1;  /* already stopped! */
+      if (strcmp(topic, "refresh") == 0) return 1;  /* nothing to refresh */
     }
     perrorDde("DdeConnect", err);
     return 0;
@@ -197,15 +304,21 @@ sendCommand(const char* topic, const char* command)
   DdeFreeStringHandle(ddeInstance, ddeTopic);
 
   ddeData= DdeCreateDataHandle(ddeInstance, (LPBYTE) command,
-                               strlen(command)+1, 0, 0, CF_TEXT, 0);
+                               lcommand, 0, 0, CF_TEXT, 0);
   if (!ddeData) {
     perrorDde("DdeCreateDataHandle", DdeGetLastError(ddeInstance));
     DdeDisconnect(ddeConv);
     return 0;
   }
   ddeReturn= DdeClientTransaction((LPBYTE) ddeData, 0xFFFFFFFF,
-                                  ddeConv, 0, CF_TEXT, XTYP_EXECUTE, 30000, NULL);
-  if (!ddeReturn) perrorDde("DdeClientTransaction", DdeGetLastError(ddeInstance));
+                                  ddeConv, 0, CF_TEXT, XTYP_EXECUTE, 30000, &result);
+  if (!ddeReturn) {
+    err= DdeGetLastError(ddeInstance);
+    if (err == DMLERR_NOTPROCESSED && (result & DDE_APPSTATUS))
+      errmsg("%s: %s\n", cmdtext(command, lcommand), strerror(result & DDE_APPSTATUS));  /* errno from cyglauncher */
+    else
+      perrorDde("DdeClientTransaction", err);
+  }
   DdeFreeDataHandle(ddeReturn);
   DdeFreeDataHandle(ddeData);
   DdeDisconnect(ddeConv);
@@ -214,38 +327,316 @@ sendCommand(const char* topic, const char* command)
 }
 
 static int
-launch(const char* u)
+requestData(const char* topic, const char* item)
 {
-  UINT err;
-  err= DdeInitialize(&ddeInstance, DdeServerProc,
-                     CBF_SKIP_ALLNOTIFICATIONS | CBF_FAIL_POKES | CBF_FAIL_REQUESTS, 0);
-  if (err != DMLERR_NO_ERROR) {
-    perrorWin("DdeInitialize error", GetLastError());
-    return 1;
+  HSZ ddeService, ddeTopic, ddeItem;
+  HCONV ddeConv;
+  HDDEDATA ddeReturn;
+  DWORD ldata;
+  char* data;
+
+  ddeService= DdeCreateStringHandle(ddeInstance, (LPTSTR) ddeServiceName, 0);
+  ddeTopic=   DdeCreateStringHandle(ddeInstance, (LPTSTR) topic, 0);
+  ddeConv= DdeConnect(ddeInstance, ddeService, ddeTopic, NULL);
+  DdeFreeStringHandle(ddeInstance, ddeService);
+  DdeFreeStringHandle(ddeInstance, ddeTopic);
+  if (!ddeConv) {
+    perrorDde("DdeConnect", DdeGetLastError(ddeInstance));
+    return 0;
   }
 
-  if (opte) {
-    sendCommand("exit", u);
-  } else {
-    dbgmsg ("command: %s\n", u);
-    sendCommand("exec", u);
+  ddeItem= DdeCreateStringHandle(ddeInstance, (LPTSTR) item, 0);
+  ddeReturn= DdeClientTransaction(NULL, 0, ddeConv, ddeItem, CF_TEXT, XTYP_REQUEST, 30000, NULL);
+  DdeFreeStringHandle(ddeInstance, ddeItem);
+  if (!ddeReturn) {
+    perrorDde("DdeClientTransaction", DdeGetLastError(ddeInstance));
+    DdeDisconnect(ddeConv);
+    return 0;
+  }
+  data= (char*) DdeAccessData(ddeReturn, &ldata);
+  if (data && ldata > 0) {
+    data[ldata-1]= '\0';
+    outmsg("%s", data);
+  }
+  DdeUnaccessData(ddeReturn);
+  DdeFreeDataHandle(ddeReturn);
+  DdeDisconnect(ddeConv);
+  return 1;
+}
+
+#ifdef __CYGWIN__
+/* Send the command through cyglauncher's shared-memory ring, if it has one.
+ * Returns -1 if there is no ring, so DDE should be used instead, or (if
+ * FAILOVER is set) SEND_BUSY if cyglauncher is handling other requests.
+ */
+static int
+sendRing(const char* command, size_t lcommand, int failover)
+{
+  struct shmring* ring;
+  int status;
+
+  if (!(ring= shmring_open(shmring_name(instance)))) return -1;
+  if (failover && shmring_queued(ring) > 0) {
+    shmring_close(ring);
+    return SEND_BUSY;
+  }
+  dbgmsg ("command (ring): %s\n", cmdtext(command, lcommand));
+  status= shmring_send(ring, command, lcommand, 30000);
+  shmring_close(ring);
+  if (status < 0 && (errno == E2BIG || errno == EAGAIN))
+    return -1;  /* too big, or skipped by cyglauncher: use DDE */
+  if (status < 0) {
+    errmsg("%s: shmring_send: cyglauncher did not respond\n", prog);
+    return 0;
+  }
+  if (status & SHMRING_ERRNO) {
+    errmsg("%s: %s\n", cmdtext(command, lcommand), strerror(status & (SHMRING_ERRNO-1)));
+    return 0;
+  }
+  if (status != SHMRING_OK) {
+    errmsg("%s: shmring_send: cyglauncher cannot handle this command\n", prog);
+    return 0;
   }
+  return 1;
+}
+#endif
+
+/* Talk to cyglauncher instance NAME (NULL or "" for the default) */
+static void
+set_instance(const char* name)
+{
+  instance= (name && *name) ? name : NULL;
+  if (instance)
+    snprintf(ddeServiceName, sizeof(ddeServiceName), "cyglaunch-%s", instance);
+  else
+    strcpy(ddeServiceName, "cyglaunch");
+}
 
-  DdeUninitialize(ddeInstance);
+#ifdef __CYGWIN__
+/* Do the request options at the start of ARGV include "!" (expand)? */
+static int
+expand_requested(size_t argc, char* const argv[])
+{
+  size_t i;
+  for (i= 0; i<argc; i++) {
+    if (!strcmp(argv[i], "!")) return 1;
+    if (argv[i][0] != '@' && argv[i][0] != '{') break;
+  }
   return 0;
 }
+#endif
 
+/* The name of the command in ARGV (after any request options), without its
+ * directory or .exe, to look up in CYGLAUNCH_ROUTES.
+ */
+static const char*
+command_name(size_t argc, char* const argv[])
+{
+  static char name[MAX_PATH];
+  const char *w, *p;
+  size_t i, l;
 
+  for (i= 0; i<argc; i++) {
+    if (argv[i][0] != '@' && argv[i][0] != '{' && strcmp(argv[i], "!")) break;
+  }
+  if (i >= argc) return NULL;
+  w= argv[i];
+  if (*w == '[') w++;  /* [WINPATH] */
+  for (p= w; *p; p++) {
+    if (*p == '/' || *p == '\\') w= p+1;
+  }
+  l= strlen(w);
+  if (l > 0 && w[l-1] == ']') l--;
+  if (l > 4 && (!strncmp(w+l-4, ".exe", 4) || !strncmp(w+l-4, ".EXE", 4))) l -= 4;
+  if (l >= sizeof(name)) return NULL;
+  memcpy(name, w, l);
+  name[l]= '\0';
+  return name;
+}
+
+/* Fill LIST with the instances to try for a request, in order. That is the
+ * -n instance, else (for an exec request) the instance CYGLAUNCH_ROUTES gives
+ * for command CMD, or the CYGLAUNCH_INSTANCES list starting at a different
+ * one each time, else CYGLAUNCH_INSTANCE or the default instance.
+ */
+static size_t
+choose_instances(int exec, const char* cmd, const char* list[], size_t maxlist)
+{
+  static char routes[1024], instances[1024];
+  const char *env, *first[sizeof(routes)/2];
+  char* tok;
+  size_t n= 0, i, start;
+
+  if (optn) {
+    list[0]= optn;
+    return 1;
+  }
+  if (exec && cmd && (env= getenv(routes_envvar))) {
+    strncpy(routes, env, sizeof(routes)-1);
+    for (tok= strtok(routes, ","); tok; tok= strtok(NULL, ",")) {
+      char* eq= strchr(tok, '=');
+      if (eq && (size_t) (eq-tok) == strlen(cmd) && !strncmp(tok, cmd, eq-tok)) {
+        list[0]= eq+1;
+        return 1;
+      }
+    }
+  }
+  if (exec && (env= getenv(instances_envvar))) {
+    strncpy(instances, env, sizeof(instances)-1);
+    for (tok= strtok(instances, ","); tok && n < maxlist; tok= strtok(NULL, ","))
+      first[n++]= tok;
+    if (n > 0) {
+      /* spread the load (Windows process IDs are multiples of 4) */
+      start= (GetCurrentProcessId() >> 2) % n;
+      for (i= 0; i<n; i++) list[i]= first[(start+i) % n];
+      return n;
+    }
+  }
+  list[0]= getenv(instance_envvar);
+  return 1;
+}
+
+/* Send the request to the current instance, trying the ring first for exec.
+ * Returns -1 if DDE could not be initialised, otherwise as sendCommand.
+ */
+static int
+sendInstance(const char* topic, const char* u, size_t lu, int failover)
+{
+  UINT err;
+#ifdef __CYGWIN__
+  int r;
+  if (!strcmp(topic, "exec") && ((r= sendRing(u, lu, failover)) >= 0 || r == SEND_BUSY))
+    return r;
+#endif
+  if (!ddeInstance) {
+    err= DdeInitialize(&ddeInstance, DdeServerProc,
+                       CBF_SKIP_ALLNOTIFICATIONS | CBF_FAIL_POKES | CBF_FAIL_REQUESTS, 0);
+    if (err != DMLERR_NO_ERROR) {
+      perrorWin("DdeInitialize error", GetLastError());
+      ddeInstance= 0;
+      return -1;
+    }
+  }
+  if (!strcmp(topic, "stats")) return requestData("stats", "stats");
+  if (!strcmp(topic, "exec")) dbgmsg ("command: %s\n", cmdtext(u, lu));
+  return sendCommand(topic, u, lu, failover);
+}
+
+/* Send request U, which is LU bytes of text (including the terminating '\0')
+ * or a packed request, for command CMD.
+ */
+static int
+launch(const char* u, size_t lu, const char* cmd)
+{
+  const char* topic= opte ? "exit" : optr ? "refresh" : opts ? "stats" : "exec";
+  const char* list[32];
+  char* xu= NULL;
+  size_t n, i, busy, absent;
+  int r= 0;
+
+  if (optx && !opte && !optr && !opts) {
+    /* ask cyglauncher to expand ~, $VAR, and wildcards (which needs text) */
+    if (!(u= cmdtext(u, lu))) {
+      errmsg("%s: command or word too long\n", prog);
+      return 2;
+    }
+    xu= (char*) malloc(strlen(u)+3);
+    strcpy(xu, "! ");
+    strcat(xu, u);
+    u= xu;
+    lu= strlen(u)+1;
+  }
+
+  n= choose_instances(!strcmp(topic, "exec"), cmd, list, sizeof(list)/sizeof(list[0]));
+  busy= absent= n;
+  for (i= 0; i<n; i++) {
+    set_instance(list[i]);
+    r= sendInstance(topic, u, lu, n > 1);
+    if      (r == SEND_BUSY)   { if (busy   == n) busy=   i; }
+    else if (r == SEND_ABSENT) { if (absent == n) absent= i; }
+    else break;
+  }
+  if (i >= n) {
+    /* all busy or not running: wait for the first busy one, or else start one */
+    set_instance(list[busy < n ? busy : absent]);
+    dbgmsg ("instance: %s\n", instance ? instance : "(default)");
+    r= sendInstance(topic, u, lu, 0);
+  }
+
+  if (ddeInstance) DdeUninitialize(ddeInstance);
+  free(xu);
+  return (r == -1) ? 1 : 0;
+}
+
+
+/* Parse option letter at P. An option argument is taken from the rest of P,
+ * or else from *OPTARG (which is then set to NULL to show it was used).
+ */
 static const char*
-parseopt(const char* p)
+parseopt(const char* p, const char** optarg)
 {
-  switch (*p++) {
+  char opt= *p++;
+#ifdef __CYGWIN__
+  static const char optargs[]= "CEnSTU";  /* options that take an argument */
+#else
+  static const char optargs[]= "n";
+#endif
+  const char* arg= NULL;
+
+  if (opt && strchr(optargs, opt)) {
+    if (*p) {
+      arg= p;
+      p += strlen(p);
+    } else if (*optarg) {
+      arg= *optarg;
+      *optarg= NULL;
+    } else {
+      return NULL;
+    }
+  }
+  switch (opt) {
+  case 'd':
+    optd= opte= 1;  /* exit, once requests in flight are done */
+    break;
   case 'e':
     opte= 1;
     break;
+  case 'r':
+    optr= 1;
+    break;
+  case 's':
+    opts= 1;
+    break;
   case 'v':
     verbose= 1;
     break;
+  case 'x':
+    optx= 1;
+    break;
+#ifdef __CYGWIN__
+  case 'C':
+    optC= arg;
+    break;
+  case 'E':
+    if (noptE >= sizeof(optE)/sizeof(optE[0]) || !strchr(arg, '=')) return NULL;
+    optE[noptE++]= arg;
+    break;
+  case 'F':
+    optF= 1;
+    break;
+  case 'S':
+    standin= arg;
+    break;
+  case 'T':
+    replay_file= arg;
+    break;
+  case 'U':
+    compare_file= arg;
+    break;
+#endif
+  case 'n':
+    optn= strdup(arg);  /* WinMain reuses its word buffers for the next option */
+    break;
   case 'h':
   case '?':
     opth= 1;
@@ -260,12 +651,24 @@ parseopt(const char* p)
 static int
 usage()
 {
-  errmsg("Usage: %s [-e | COMMAND]\n", prog);
+#ifdef __CYGWIN__
+  errmsg("Usage: %s [-n INSTANCE] [-e | -d | -s | -r [PROFILE...] | -T TRACE [-U TRACE] [-F] [-S CMD] | [-x] [-C DIR] [-E NAME=VALUE]... [@PROFILE] COMMAND]\n", prog);
+#else
+  errmsg("Usage: %s [-n INSTANCE] [-e | -d | -s | -r [PROFILE...] | [-x] [@PROFILE] COMMAND]\n", prog);
+#endif
   return 1;
 }
 
 
 #ifdef __CYGWIN__
+static int
+replaySend(const char* topic, const char* data, size_t ldata)
+{
+  int ok;
+  if (!strcmp(topic, "exec") && (ok= sendRing(data, ldata, 0)) >= 0) return ok;
+  return sendCommand(topic, data, ldata, 0);
+}
+
 int
 main(int argc, char* argv[])
 {
@@ -276,59 +679,149 @@ main(int argc, char* argv[])
   if (argc < 2) return usage();
 
   for (i= 1; i < argc; i++) {
-    const char* p;
+    const char *p, *next;
     if (argv[i][0] != '-') break;
     if (argv[i][1] == '-' && argv[i][2] == '\0') {
       i++;
       break;
     }
+    next= (i+1 < argc) ? argv[i+1] : NULL;
     for (p= argv[i]+1; *p;) {
-      p= parseopt(p);
+      p= parseopt(p, &next);
       if (!p) {
         errmsg("%s: invalid option: %s\n", prog, argv[i]);
         return 2;
       }
     }
+    if (i+1 < argc && !next) i++;
+  }
+
+  if (replay_file) {
+    UINT err;
+    int ok;
+    if (opth || i < argc) return usage();
+    set_instance(optn ? optn : getenv(instance_envvar));
+    err= DdeInitialize(&ddeInstance, DdeServerProc,
+                       CBF_SKIP_ALLNOTIFICATIONS | CBF_FAIL_POKES | CBF_FAIL_REQUESTS, 0);
+    if (err != DMLERR_NO_ERROR) {
+      perrorWin("DdeInitialize error", GetLastError());
+      return 1;
+    }
+    ok= replay(replay_file, compare_file, optF, standin, replaySend);
+    DdeUninitialize(ddeInstance);
+    return ok ? 0 : 1;
+  }
+
+  if (opth || compare_file || (!opte && !optr && !opts && i >= argc)) return usage();
+
+  if (!opte && !optr && !opts) {
+    /* send the words as they are, without escaping */
+    struct argpack pk;
+    char cwd[PATH_MAX];
+    const char* cmd= command_name(argc-i, argv+i);
+    int expand= expand_requested(argc-i, argv+i);
+    size_t j;
+    int ok= 1, ret;
+
+    argpack_init(&pk);
+    if (optC) {
+      if (optC[0] != '/' && getcwd(cwd, sizeof(cwd)) &&
+          strlen(cwd) + strlen(optC) + 2 <= sizeof(cwd)) {
+        strcat(cwd, "/");
+        strcat(cwd, optC);
+        optC= cwd;
+      }
+      ok= argpack_add(&pk, ARGPACK_CWD, optC);
+    }
+    for (j= 0; ok && j<noptE; j++)
+      ok= argpack_add(&pk, ARGPACK_ENV, optE[j]);
+    for (; ok && i<argc; i++)
+      ok= argpack_add(&pk, ARGPACK_ARG, argv[i]);
+    if (!ok) {
+      errmsg("%s: out of memory\n", prog);
+      return 2;
+    }
+    if (expand && !optx) {
+      /* cyglauncher only expands text requests (as for -x) */
+      char* text;
+      if (!(u= cmdtext(pk.data, pk.ldata))) {
+        errmsg("%s: command or word too long\n", prog);
+        free(pk.data);
+        return 2;
+      }
+      text= strdup(u);
+      ret= launch(text, strlen(text)+1, cmd);
+      free(text);
+    } else {
+      ret= launch(pk.data, pk.ldata, cmd);
+    }
+    free(pk.data);
+    return ret;
   }
 
-  u= escargs(argc-i, argv+i);
+  u= optd ? "drain" : escargs(argc-i, argv+i);
   if (!u) {
     errmsg("%s: command or word too long\n", prog);
     return 2;
   }
 
-  if (opth || (!opte && *u == '\0')) return usage();
-
-  return launch(u);
+  return launch(u, strlen(u)+1, NULL);
 }
 
 #else
 
+/* Copy the word at P into WORD, and return the position after it */
+static const char*
+getword(const char* p, char* word, size_t lword)
+{
+  size_t i= 0;
+  for (; *p && !isspace(*p); p++) {
+    if (i+1 < lword) word[i++]= *p;
+  }
+  word[i]= '\0';
+  return p;
+}
+
 int APIENTRY
 WinMain(HINSTANCE hInst, HINSTANCE gPrevInst, LPSTR lpCmdLine, int nCmdShow)
 {
-  const char *p;
-  for (p= lpCmdLine; *p; p++) {
-    if (isspace(*p)) continue;
+  const char *p= lpCmdLine;
+  char word[MAX_PATH], next[MAX_PATH];
+  char *argv[1024], *argbuf;
+  size_t largbuf;
+  int argc, ret;
+
+  for (;;) {
+    const char *q, *after, *arg;
+    while (isspace(*p)) p++;
     if (*p != '-') break;
-    p++;
-    if (*p == '-' && (p[1] == '\0' || isspace(p[1]))) {
-      p++;
+    p= getword(p, word, sizeof(word));
+    if (!strcmp(word, "--")) {
       while (isspace(*p)) p++;
       break;
     }
-    while (*p && !isspace(*p)) {
-      const char* q= p;
-      p= parseopt(p);
-      if (!p) {
-        errmsg("%s: invalid option: -%c\n", prog, *q);
+    for (after= p; isspace(*after); after++) ;
+    after= getword(after, next, sizeof(next));
+    arg= next[0] ? next : NULL;
+    for (q= word+1; *q;) {
+      const char* o= q;
+      q= parseopt(q, &arg);
+      if (!q) {
+        errmsg("%s: invalid option: -%c\n", prog, *o);
         return 2;
       }
     }
+    if (next[0] && !arg) p= after;
   }
 
-  if (opth || (!opte && *p == '\0')) return usage();
+  if (opth || (!opte && !optr && !opts && *p == '\0')) return usage();
 
-  return launch(p);
+  if (optd) p= "drain";
+  largbuf= strlen(p)+1;
+  argbuf= (char*) malloc(largbuf);
+  argc= splitargs(p, argv, sizeof(argv)/sizeof(argv[0]), argbuf, largbuf);
+  ret= launch(p, largbuf, (argc > 0) ? command_name(argc, argv) : NULL);
+  free(argbuf);
+  return ret;
 }
 #endif
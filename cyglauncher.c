@@ -10,36 +10,163 @@
  * This software is provided "as is" without express or implied warranty.
  */
 
+#define _GNU_SOURCE  /* for sched_setaffinity */
 #include <stdlib.h>
 #include <stdio.h>
+#include <ctype.h>
 #include <unistd.h>
 #include <time.h>
 #include <errno.h>
-#ifdef __CYGWIN__
+#include <fcntl.h>
+#include <poll.h>
 #include <signal.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sched.h>
+#include <pthread.h>
+#include <semaphore.h>
+#ifdef __CYGWIN__
 #include <sys/cygwin.h>
 #endif
 #include <windows.h>
 
+#include "argpack.h"
 #include "escstr.h"
+#include "execpath.h"
+#include "history.h"
+#include "prewarm.h"
+#include "shmring.h"
+#include "trace.h"
 
 typedef int (*topicHandlerType)(const void *data, DWORD ldata);
-static const char ddeServiceName[]= "cyglaunch";
+static char ddeServiceName[64]= "cyglaunch";  /* "cyglaunch-INSTANCE" for a named instance */
+static HANDLE busyEvent= NULL;  /* "SERVICE-busy": set while we are handling a request */
+static const char instance_envvar[]= "CYGLAUNCHER_INSTANCE";
+static const char *instance= NULL;
 static const char cmd_envvar[]= "CYGLAUNCH_EXEC";  /* must be upper case because Cygwin converts DOS envvars to u/c */
 static const char exit_envvar[]= "CYGLAUNCHER_EXIT_CMD";
 static const char exit_cmd[]= "cyglauncher-exit";
+static const char history_envvar[]= "CYGLAUNCHER_HISTORY";
+static const char history_file[]= ".cyglauncher_history";  /* in $HOME */
+static const size_t expand_bufsize= 32768;  /* Windows command line limit */
+static const UINT reap_interval= 250;    /* ms between checks for finished children */
+static const UINT save_interval= 60000;  /* ms between saves of changed history */
+static const int capture_wait= 15000;    /* ms to wait for a profile's login shell */
+static const double kill_grace= 5.0;     /* s between SIGTERM and SIGKILL for an expired deadline */
+static char *history_path= NULL;
+static size_t prewarm_count= 10;        /* most frequent commands to prefetch */
+static size_t prewarm_budget= 64;       /* prefetch limit, MB */
+static size_t drain_timeout= 10;        /* s to finish requests in flight when draining */
 static const char *prog;
 static DWORD ddeInstance= 0;
-static int opth= 0, optH= 0;
+static int opth= 0, optH= 0, optR= 0;
+static DWORD mainThread;
+static struct shmring* ring= NULL;
+static pthread_t ring_thread;
+static sem_t ring_drained;
+static FILE* tracefile= NULL;
+static int request_errno= 0;   /* why the current request's command could not be run */
+static int draining= 0;        /* shutting down once requests in flight are done */
+static struct timespec drain_start;
+static long nconversations= 0;
+#define WM_RING (WM_APP+1)
+#define WM_REAP (WM_APP+2)
+
+extern char **environ;
+
+/* A profile is a named environment captured once from a login shell,
+ * selected by an "@NAME" word at the start of a request.
+ */
+struct profile {
+  const char* name;
+  const char* setup;    /* shell commands run before capture, or NULL */
+  char*  envbuf;        /* captured NAME=VALUE\0... block */
+  char** envp;          /* pointers into envbuf, NULL if capture failed */
+};
+static struct profile profiles[32];
+static size_t nprofiles= 0;
+
+/* Execution attributes, from a "{name=value,...}" request option */
+struct attrs {
+  double timeout, cputime;  /* deadlines, seconds (0 for none) */
+  int set_nice, nice;
+#ifdef CPU_SET
+  int set_cpus;
+  cpu_set_t cpus;
+#endif
+  size_t nrlimits;
+  struct {
+    int resource;
+    struct rlimit lim;
+  } rlimits[8];
+};
+static struct attrs default_attrs;
+
+static const struct {
+  const char* name;
+  int resource;
+} rlimit_names[]= {
+  {"as",     RLIMIT_AS},
+  {"core",   RLIMIT_CORE},
+  {"cpu",    RLIMIT_CPU},
+  {"data",   RLIMIT_DATA},
+  {"fsize",  RLIMIT_FSIZE},
+  {"nofile", RLIMIT_NOFILE},
+  {"stack",  RLIMIT_STACK},
+};
+
+/* Options parsed from the start of a request */
+struct request {
+  const struct profile* profile;
+  struct attrs attrs;
+  const char* cwd;          /* from a packed request, or NULL */
+  char* const* env;         /* NAME=VALUE settings from a packed request */
+  size_t nenv;
+  struct timespec received;
+};
+
+/* A supervised child's next deadline check, in the timer wheel.
+ * The wheel has one slot per reap_interval tick, and a deadline is kept in
+ * slot DUE%WHEEL_SLOTS, so each tick only looks at the deadlines in one slot.
+ */
+#define WHEEL_SLOTS 256   /* must be a power of 2 */
+struct deadline {
+  struct deadline *next, **prev;   /* prev is NULL when not in the wheel */
+  pid_t pid;
+  const char* path;         /* the child's argv[0] */
+  unsigned long due;        /* tick of next check */
+  unsigned long wall_due;   /* tick the wall-clock deadline expires, or 0 */
+  double cputime;           /* CPU time limit, seconds, or 0 */
+  int signals;              /* 1 after SIGTERM, 2 after SIGKILL */
+};
+static struct deadline* wheel[WHEEL_SLOTS];
+static unsigned long wheel_tick= 0;   /* last tick handled */
+static struct timespec wheel_start;
+
+/* A running child, kept until it is reaped so its resource use can be recorded */
+struct child {
+  pid_t  pid;
+  char*  path;              /* argv[0] */
+  struct timespec start;
+  struct timespec received; /* request received (or start, if none) */
+  double latency;           /* received -> exec, or -> fork until the exec time is known, seconds */
+  struct deadline* deadline;  /* NULL if not supervised */
+  int execfd;               /* exec status pipe, or -1 once it is closed */
+  char execbuf[sizeof(struct timespec)+sizeof(int)];  /* exec time, then errno if it failed */
+  size_t nexec;             /* bytes of execbuf read so far */
+};
+static struct child* children= NULL;
+static size_t nchildren= 0, maxchildren= 0;
 
 
 static const char*
 myasctime()
 {
   static char buf[20];
+  struct tm tm;
   time_t t;
   t= time(NULL);
-  strftime(buf, sizeof(buf), "%Y/%m/%d-%H:%M:%S", localtime(&t));
+  strftime(buf, sizeof(buf), "%Y/%m/%d-%H:%M:%S", localtime_r(&t, &tm));
   return buf;
 }
 
@@ -62,12 +189,762 @@ perrorWin(const char* prefix, DWORD errnum)
     LocalFree(lpMsgBuf);
 }
 
+static double
+interval(const struct timespec* t0, const struct timespec* t1)
+{
+  return (t1->tv_sec - t0->tv_sec) + 1e-9 * (t1->tv_nsec - t0->tv_nsec);
+}
+
+static double
+elapsed(const struct timespec* t0)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return interval(t0, &t);
+}
+
+static unsigned long
+seconds_to_ticks(double secs)
+{
+  return (unsigned long) (secs * 1000.0 / reap_interval) + 1;
+}
+
+static void
+schedule(struct deadline* d, unsigned long due)
+{
+  struct deadline** slot;
+  if (due <= wheel_tick) due= wheel_tick+1;
+  d->due= due;
+  slot= &wheel[due & (WHEEL_SLOTS-1)];
+  if ((d->next= *slot)) d->next->prev= &d->next;
+  d->prev= slot;
+  *slot= d;
+}
+
+static void
+unschedule(struct deadline* d)
+{
+  if (!d->prev) return;
+  if ((*d->prev= d->next)) d->next->prev= d->prev;
+  d->prev= NULL;
+}
+
+/* CPU time used by PID so far, in seconds, or -1 if not known */
+static double
+cpu_used(pid_t pid)
+{
+  char buf[512], *p;
+  unsigned long utime, stime;
+  FILE* f;
+  int n;
+
+  snprintf(buf, sizeof(buf), "/proc/%d/stat", (int) pid);
+  if (!(f= fopen(buf, "r"))) return -1.0;
+  n= fread(buf, 1, sizeof(buf)-1, f);
+  fclose(f);
+  buf[n > 0 ? n : 0]= '\0';
+  /* skip "pid (comm)", which may contain spaces, then fields 3-13 */
+  if (!(p= strrchr(buf, ')')) ||
+      sscanf(p+1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2)
+    return -1.0;
+  return (double) (utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+/* A deadline check is due: signal the child if it has run out of time,
+ * or else check again when it might have done.
+ */
+static void
+expire(struct deadline* d)
+{
+  const char* what= NULL;
+  double used= 0.0;
+
+  if (d->signals) {
+    if (d->signals > 1) return;
+    fprintf(stderr, "%s-%d: %s still running %gs after SIGTERM, sending SIGKILL\n",
+            myasctime(), d->pid, d->path, kill_grace);
+    fflush(stderr);
+    kill(d->pid, SIGKILL);
+    d->signals= 2;
+    return;
+  }
+  if (d->wall_due && wheel_tick >= d->wall_due) {
+    what= "wall-clock time";
+  } else if (d->cputime > 0.0 && (used= cpu_used(d->pid)) >= 0.0) {
+    unsigned long due;
+    if (used >= d->cputime) {
+      what= "CPU time";
+    } else {
+      /* can't use CPU faster than real time (per CPU) */
+      due= wheel_tick + seconds_to_ticks(d->cputime - used);
+      if (d->wall_due && d->wall_due < due) due= d->wall_due;
+      schedule(d, due);
+      return;
+    }
+  } else {
+    if (d->wall_due) schedule(d, d->wall_due);
+    return;
+  }
+  fprintf(stderr, "%s-%d: %s exceeded its %s deadline, sending SIGTERM\n",
+          myasctime(), d->pid, d->path, what);
+  fflush(stderr);
+  kill(d->pid, SIGTERM);
+  d->signals= 1;
+  schedule(d, wheel_tick + seconds_to_ticks(kill_grace));
+}
+
+/* The tick now, which wheel_tick lags until run_deadlines catches up */
+static unsigned long
+current_tick()
+{
+  return (unsigned long) (elapsed(&wheel_start) * 1000.0 / reap_interval);
+}
+
+/* Handle the deadlines that fell due since we were last called */
+static void
+run_deadlines()
+{
+  unsigned long now= current_tick();
+  if (now > wheel_tick + WHEEL_SLOTS)
+    wheel_tick= now - WHEEL_SLOTS;  /* one turn of the wheel catches up */
+  while (wheel_tick < now) {
+    struct deadline *d, *next;
+    wheel_tick++;
+    for (d= wheel[wheel_tick & (WHEEL_SLOTS-1)]; d; d= next) {
+      next= d->next;
+      if (d->due > wheel_tick) continue;  /* a later turn */
+      unschedule(d);
+      expire(d);
+    }
+  }
+}
+
+static void
+add_child(const struct request* req, pid_t pid, const char* path, int execfd)
+{
+  const struct attrs* a= req ? &req->attrs : &default_attrs;
+  struct child* c;
+  if (nchildren >= maxchildren) {
+    maxchildren= maxchildren ? 2*maxchildren : 64;
+    children= (struct child*) realloc (children, maxchildren * sizeof(*children));
+  }
+  c= &children[nchildren++];
+  c->pid= pid;
+  c->path= strdup (path);
+  clock_gettime(CLOCK_MONOTONIC, &c->start);
+  c->received= req ? req->received : c->start;
+  c->latency= interval(&c->received, &c->start);
+  c->deadline= NULL;
+  c->execfd= execfd;
+  c->nexec= 0;
+  if (a->timeout > 0.0 || a->cputime > 0.0) {
+    struct deadline* d= (struct deadline*) calloc (1, sizeof(*d));
+    unsigned long now= current_tick(), due;
+    d->pid= pid;
+    d->path= c->path;
+    d->cputime= a->cputime;
+    if (a->timeout > 0.0) d->wall_due= now + seconds_to_ticks(a->timeout);
+    due= (a->cputime > 0.0) ? now + seconds_to_ticks(a->cputime) : d->wall_due;
+    if (d->wall_due && d->wall_due < due) due= d->wall_due;
+    schedule(d, due);
+    c->deadline= d;
+  }
+}
+
+/* Read the child's exec status pipe, without waiting. The child sends the
+ * time it called exec, which closes the pipe if it succeeds, or else the
+ * child sends its errno too.
+ */
+static void
+check_exec(struct child* c)
+{
+  struct timespec t;
+  ssize_t n;
+  int err;
+
+  while (c->execfd >= 0) {
+    n= read(c->execfd, c->execbuf + c->nexec, sizeof(c->execbuf) - c->nexec);
+    if (n > 0) {
+      c->nexec += n;
+      continue;
+    }
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0 && errno == EAGAIN) return;  /* not exec'd yet */
+    close(c->execfd);
+    c->execfd= -1;
+    if (c->nexec >= sizeof(t)) {
+      memcpy(&t, c->execbuf, sizeof(t));
+      c->latency= interval(&c->received, &t);
+    }
+    if (c->nexec == sizeof(c->execbuf)) {
+      memcpy(&err, c->execbuf + sizeof(t), sizeof(err));
+      fprintf(stderr, "%s-%d: %s\n", myasctime(), c->pid, c->path);
+      errno= err;
+      perror("  -> exec failed");
+      fflush(stderr);
+    }
+  }
+}
+
+/* Collect the exit status and resource usage of any finished children */
+static void
+reap_children()
+{
+  struct history_sample s;
+  struct rusage ru;
+  int status;
+  pid_t pid;
+  size_t i;
+
+  for (i= 0; i<nchildren; i++)
+    check_exec(&children[i]);
+  while ((pid= wait4(-1, &status, WNOHANG, &ru)) > 0) {
+    for (i= 0; i<nchildren && children[i].pid != pid; i++) ;
+    if (i >= nchildren) continue;
+    check_exec(&children[i]);
+    s.failed= !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+    s.utime=  ru.ru_utime.tv_sec + 1e-6 * ru.ru_utime.tv_usec;
+    s.stime=  ru.ru_stime.tv_sec + 1e-6 * ru.ru_stime.tv_usec;
+    s.wall=   elapsed (&children[i].start);
+    s.latency= children[i].latency;
+    s.maxrss= ru.ru_maxrss;
+    history_record (history_name (children[i].path), children[i].path, &s);
+    if (children[i].deadline) {
+      unschedule(children[i].deadline);
+      free(children[i].deadline);
+    }
+    if (children[i].execfd >= 0) close(children[i].execfd);
+    free(children[i].path);
+    children[i]= children[--nchildren];
+  }
+}
+
+static void
+save_history()
+{
+  if (!history_path || !history_dirty) return;
+  if (!history_save (history_path)) {
+    fprintf(stderr, "%s: ", myasctime());
+    perror(history_path);
+    fflush(stderr);
+  }
+}
+
+/* Log the children that are still running */
+static void
+log_children()
+{
+  size_t i;
+  reap_children();
+  fprintf(stderr, "%s: %lu still running\n", myasctime(), (unsigned long) nchildren);
+  for (i= 0; i<nchildren; i++)
+    fprintf(stderr, "  %6d %9.1fs  %s\n", (int) children[i].pid, elapsed (&children[i].start), children[i].path);
+  fflush(stderr);
+}
+
+/* While draining, quit once there are no conversations or ring requests
+ * left, or drain_timeout has expired.
+ */
+static void
+check_drained()
+{
+  size_t queued;
+  if (!draining) return;
+  queued= ring ? shmring_queued(ring) : 0;
+  if (nconversations > 0 || queued > 0) {
+    if (elapsed (&drain_start) < drain_timeout) return;
+    fprintf(stderr, "%s: drain timed out with %ld conversations and %lu ring requests left\n",
+            myasctime(), nconversations, (unsigned long) queued);
+    fflush(stderr);
+  }
+  draining= 0;
+  PostQuitMessage(1);  /* wParam 1: drained */
+}
+
+/* Stop accepting requests: new clients will find no cyglauncher */
+static void
+start_drain()
+{
+  if (draining) return;
+  draining= 1;
+  clock_gettime(CLOCK_MONOTONIC, &drain_start);
+  fprintf(stderr, "%s: draining (up to %lus)\n", myasctime(), (unsigned long) drain_timeout);
+  fflush(stderr);
+  DdeNameService(ddeInstance, 0L, 0L, DNS_UNREGISTER);
+  shmring_unlink(ring);
+  check_drained();
+}
+
+/* SIGCHLD: reap now, rather than at the next timer tick, so a child's
+ * wall-clock time is not inflated by up to reap_interval.
+ */
+static void
+childExited(int sig)
+{
+  int err= errno;
+  PostThreadMessage(mainThread, WM_REAP, 0, 0);
+  errno= err;
+}
+
+static VOID CALLBACK
+reapTimer(HWND hwnd, UINT uMsg, UINT_PTR idEvent, DWORD dwTime)
+{
+  static UINT since_save= 0;
+  reap_children();
+  run_deadlines();
+  check_drained();
+  since_save += reap_interval;
+  if (since_save >= save_interval) {
+    since_save= 0;
+    save_history();
+  }
+}
+
+static struct profile*
+find_profile(const char* name)
+{
+  size_t i;
+  for (i= 0; i<nprofiles; i++) {
+    if (!strcmp (name, profiles[i].name))
+      return &profiles[i];
+  }
+  return NULL;
+}
+
+/* Define a profile from a NAME[=SETUP] option argument */
+static int
+add_profile(const char* arg)
+{
+  struct profile* pr;
+  const char* eq;
+  char* name;
+
+  if (nprofiles >= sizeof(profiles)/sizeof(profiles[0])) return 0;
+  eq= strchr (arg, '=');
+  if (eq == arg || *arg == '\0') return 0;
+  name= strdup (arg);
+  if (eq) name[eq-arg]= '\0';
+  if (find_profile (name)) {
+    free(name);
+    return 0;
+  }
+  pr= &profiles[nprofiles++];
+  pr->name= name;
+  pr->setup= eq ? eq+1 : NULL;
+  pr->envbuf= NULL;
+  pr->envp= NULL;
+  return 1;
+}
+
+/* Run a login shell with the profile's setup commands and capture the
+ * resulting environment (written with "env -0" to fd 3, so that anything
+ * the login scripts print to stdout still goes to our log).
+ */
+static int
+capture_profile(struct profile* pr)
+{
+  static const char capture[]= "exec env -0 >&3";
+  const char* shell;
+  char *script, *buf= NULL, **envp, *p;
+  size_t lbuf= 0, nbuf= 0, nenv, i;
+  ssize_t n;
+  int fd[2], status;
+  pid_t pid;
+  struct timespec t0;
+
+  shell= getenv ("SHELL");
+  if (!shell || !*shell) shell= "/bin/sh";
+  script= (char*) malloc ((pr->setup ? strlen (pr->setup) : 0) + sizeof(capture) + 1);
+  if (pr->setup) {
+    strcpy (script, pr->setup);
+    strcat (script, "\n");
+  } else {
+    script[0]= '\0';
+  }
+  strcat (script, capture);
+
+  if (pipe (fd)) {
+    fprintf(stderr, "%s: profile %s\n", myasctime(), pr->name);
+    perror("  -> pipe failed");
+    fflush(stderr);
+    free(script);
+    return 0;
+  }
+  fflush(NULL);
+  if ((pid= fork()) == 0) {
+    int null;
+    close(fd[0]);
+    if (fd[1] != 3) {
+      dup2(fd[1], 3);
+      close(fd[1]);
+    }
+    /* don't let the profile prompt on our console, and let us kill
+       anything it starts if it hangs */
+    if ((null= open("/dev/null", O_RDONLY)) >= 0 && null != 0) {
+      dup2(null, 0);
+      close(null);
+    }
+    setpgid(0, 0);
+    execl(shell, shell, "-l", "-c", script, (char*) NULL);
+    perror(shell);
+    exit((errno == ENOENT) ? 127 : 126);
+  }
+  close(fd[1]);
+  free(script);
+  if (pid == -1) {
+    fprintf(stderr, "%s: profile %s\n", myasctime(), pr->name);
+    perror("  -> fork failed");
+    fflush(stderr);
+    close(fd[0]);
+    return 0;
+  }
+
+  /* Background jobs started by the profile inherit fd 3, so EOF may never
+     come: stop once the shell (by then, env) has exited, and take what it wrote. */
+  fcntl(fd[0], F_SETFL, O_NONBLOCK);
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for (;;) {
+    struct pollfd pfd;
+    int wait, exited= (waitpid(pid, &status, WNOHANG) == pid);
+    for (;;) {
+      if (nbuf+1 >= lbuf) {
+        lbuf= lbuf ? 2*lbuf : 16384;
+        buf= (char*) realloc (buf, lbuf);
+      }
+      n= read(fd[0], buf+nbuf, lbuf-nbuf-1);
+      if (n > 0) nbuf += n;
+      else if (n == 0 || errno != EINTR) break;  /* EOF, or nothing more yet */
+    }
+    if (exited) break;
+    wait= capture_wait - (int) (elapsed (&t0) * 1000.0);
+    if (wait <= 0) {
+      fprintf(stderr, "%s: profile %s: login shell did not finish in %ds, killed\n",
+              myasctime(), pr->name, capture_wait/1000);
+      fflush(stderr);
+      kill(-pid, SIGKILL);
+      kill(pid, SIGKILL);
+      while (waitpid(pid, &status, 0) == -1 && errno == EINTR) ;
+      nbuf= 0;
+      break;
+    }
+    pfd.fd= (n == 0) ? -1 : fd[0];  /* after EOF, just wait for the shell */
+    pfd.events= POLLIN;
+    poll(&pfd, 1, wait < 50 ? wait : 50);  /* recheck the shell every 50 ms */
+  }
+  close(fd[0]);
+
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 || nbuf == 0) {
+    fprintf(stderr, "%s: profile %s: environment capture failed (status %d)\n",
+            myasctime(), pr->name, status);
+    fflush(stderr);
+    free(buf);
+    return 0;
+  }
+  buf[nbuf]= '\0';  /* in case the last entry was not terminated */
+
+  for (nenv= 0, p= buf; p < buf+nbuf; p += strlen(p)+1) nenv++;
+  envp= (char**) malloc ((nenv+1) * sizeof(char*));
+  for (i= 0, p= buf; p < buf+nbuf; p += strlen(p)+1) envp[i++]= p;
+  envp[i]= NULL;
+
+  free(pr->envbuf);
+  free(pr->envp);
+  pr->envbuf= buf;
+  pr->envp= envp;
+  fprintf(stderr, "%s: profile %s: captured %lu variables\n",
+          myasctime(), pr->name, (unsigned long) nenv);
+  fflush(stderr);
+  return 1;
+}
+
+/* Parse a resource limit value: a number with optional K, M, or G suffix,
+ * or "unlimited".
+ */
+static int
+parse_rlim(const char* s, const char** end, rlim_t* val)
+{
+  unsigned long long n;
+  char* e;
+
+  if (!strncmp (s, "unlimited", 9)) {
+    *val= RLIM_INFINITY;
+    *end= s+9;
+    return 1;
+  }
+  n= strtoull (s, &e, 10);
+  if (e == s) return 0;
+  switch (*e) {
+  case 'k': case 'K': n <<= 10; e++; break;
+  case 'm': case 'M': n <<= 20; e++; break;
+  case 'g': case 'G': n <<= 30; e++; break;
+  }
+  *val= (rlim_t) n;
+  *end= e;
+  return 1;
+}
+
+/* Parse a duration: seconds, or a number with s, m, h, or d suffix */
+static int
+parse_duration(const char* s, const char** end, double* secs)
+{
+  char* e;
+  double v= strtod (s, &e);
+  if (e == s || !(v >= 0.0)) return 0;
+  switch (*e) {
+  case 's':                 e++; break;
+  case 'm': v *= 60.0;      e++; break;
+  case 'h': v *= 3600.0;    e++; break;
+  case 'd': v *= 86400.0;   e++; break;
+  }
+  *secs= v;
+  *end= e;
+  return 1;
+}
+
+#ifdef CPU_SET
+/* Parse a CPU list, eg. "0,2-3", up to the first item that isn't a number */
+static const char*
+parse_cpus(const char* s, cpu_set_t* set)
+{
+  CPU_ZERO(set);
+  for (;;) {
+    unsigned long lo, hi;
+    char* e;
+    lo= hi= strtoul (s, &e, 10);
+    if (e == s) return NULL;
+    if (*e == '-') {
+      const char* h= e+1;
+      hi= strtoul (h, &e, 10);
+      if (e == h || hi < lo) return NULL;
+    }
+    if (hi >= CPU_SETSIZE) return NULL;
+    for (; lo <= hi; lo++) CPU_SET(lo, set);
+    s= e;
+    if (*s != ',' || !isdigit (s[1])) return s;
+    s++;
+  }
+}
+#endif
+
+/* Parse execution attributes "name=value,..." (optionally in braces) into A.
+ * Returns NULL if OK, or else a message saying what is wrong with them.
+ */
+static const char*
+parse_attrs(const char* s, struct attrs* a)
+{
+  static char msg[256];
+  const char *p, *v, *e;
+  size_t l, i;
+  char* end;
+
+  if (*s == '{') {
+    s++;
+    l= strlen (s);
+    if (!l || s[l-1] != '}')
+      return "missing '}' in attributes";
+  }
+  for (p= s; *p && *p != '}'; p= (*e == ',') ? e+1 : e) {
+    if (!(v= strchr (p, '=')) || strchr (",}", *p)) {
+      snprintf(msg, sizeof(msg), "invalid attributes: %s", p);
+      return msg;
+    }
+    l= v++ - p;
+    if (l == 7 && !strncmp (p, "timeout", 7)) {
+      if (!parse_duration (v, &e, &a->timeout)) break;
+    } else if (l == 7 && !strncmp (p, "cputime", 7)) {
+      if (!parse_duration (v, &e, &a->cputime)) break;
+    } else if (l == 4 && !strncmp (p, "nice", 4)) {
+      a->nice= strtol (v, &end, 10);
+      if ((e= end) == v) break;
+      a->set_nice= 1;
+#ifdef CPU_SET
+    } else if (l == 4 && !strncmp (p, "cpus", 4)) {
+      if (!(e= parse_cpus (v, &a->cpus))) break;
+      a->set_cpus= 1;
+#endif
+    } else if (l > 7 && !strncmp (p, "rlimit_", 7)) {
+      struct rlimit lim;
+      for (i= 0; i<sizeof(rlimit_names)/sizeof(rlimit_names[0]); i++) {
+        if (strlen (rlimit_names[i].name) == l-7 && !strncmp (p+7, rlimit_names[i].name, l-7))
+          break;
+      }
+      if (i >= sizeof(rlimit_names)/sizeof(rlimit_names[0])) {
+        snprintf(msg, sizeof(msg), "unknown resource limit: %.*s", (int) l, p);
+        return msg;
+      }
+      if (!parse_rlim (v, &e, &lim.rlim_cur)) break;
+      lim.rlim_max= lim.rlim_cur;
+      if (*e == ':' && !parse_rlim (e+1, &e, &lim.rlim_max)) break;
+      for (l= 0; l<a->nrlimits && a->rlimits[l].resource != rlimit_names[i].resource; l++) ;
+      if (l >= sizeof(a->rlimits)/sizeof(a->rlimits[0])) break;
+      if (l == a->nrlimits) a->nrlimits++;
+      a->rlimits[l].resource= rlimit_names[i].resource;
+      a->rlimits[l].lim= lim;
+    } else {
+      snprintf(msg, sizeof(msg), "unknown attribute: %.*s", (int) l, p);
+      return msg;
+    }
+    if (*e && !strchr (",}", *e)) break;
+  }
+  if (*p && *p != '}') {
+    snprintf(msg, sizeof(msg), "invalid attribute value: %s", p);
+    return msg;
+  }
+  return NULL;
+}
+
+/* Apply the attributes in a child. Failures are reported, but not fatal. */
+static void
+apply_attrs(const struct attrs* a, const char* cmd)
+{
+  size_t i;
+  if (a->set_nice && setpriority(PRIO_PROCESS, 0, a->nice))
+    fprintf(stderr, "%s: cannot set nice %d: %s\n", cmd, a->nice, strerror(errno));
+#ifdef CPU_SET
+  if (a->set_cpus && sched_setaffinity(0, sizeof(a->cpus), &a->cpus))
+    fprintf(stderr, "%s: cannot set CPU affinity: %s\n", cmd, strerror(errno));
+#endif
+  for (i= 0; i<a->nrlimits; i++) {
+    if (setrlimit(a->rlimits[i].resource, &a->rlimits[i].lim))
+      fprintf(stderr, "%s: cannot set resource limit %d: %s\n", cmd, a->rlimits[i].resource, strerror(errno));
+  }
+}
+
+/* Strip leading request options ("@PROFILE", "!", or "{ATTRS}") from ARGV */
+static int
+parse_request(struct request* req, size_t* argc, char** argv[])
+{
+  req->profile= NULL;  /* req->received, cwd, and env are set by caller */
+  req->attrs= default_attrs;
+  while (*argc > 0) {
+    const char* word= (*argv)[0];
+    if (!strcmp (word, "!")) {
+      /* expansion was done by run_cmd: see expand_requested() */
+    } else if (word[0] == '{') {
+      const char* err;
+      if ((err= parse_attrs (word, &req->attrs))) {
+        fprintf(stderr, "%s: %s\n", myasctime(), escargs(*argc, *argv));
+        fprintf(stderr, "  -> %s\n", err);
+        fflush(stderr);
+        return 0;
+      }
+    } else if (word[0] == '@') {
+      const char* name= word+1;
+      if (!(req->profile= find_profile (name))) {
+        fprintf(stderr, "%s: %s\n", myasctime(), escargs(*argc, *argv));
+        fprintf(stderr, "  -> unknown profile: %s\n", name);
+        fflush(stderr);
+        return 0;
+      }
+      if (!req->profile->envp) {
+        fprintf(stderr, "%s: %s\n", myasctime(), escargs(*argc, *argv));
+        fprintf(stderr, "  -> profile %s has no environment\n", name);
+        fflush(stderr);
+        return 0;
+      }
+    } else {
+      break;
+    }
+    (*argc)--;
+    (*argv)++;
+  }
+  return 1;
+}
+
+/* Is "!" among the request options at the start of ARGV? */
 static int
-spawn(size_t argc, char* const argv[], int show_err)
+expand_requested(int argc, char* const argv[])
+{
+  int i;
+  for (i= 0; i<argc; i++) {
+    if (!strcmp (argv[i], "!")) return 1;
+    if (argv[i][0] != '@' && argv[i][0] != '{') break;
+  }
+  return 0;
+}
+
+/* Set up the child for the request. Returns 0, with errno set, if it
+ * cannot be run.
+ */
+static int
+apply_request(const struct request* req, const char* cmd)
+{
+  size_t i;
+  if (!req) {
+    apply_attrs(&default_attrs, cmd);
+    return 1;
+  }
+  apply_attrs(&req->attrs, cmd);
+  if (req->profile)
+    environ= req->profile->envp;
+  for (i= 0; i<req->nenv; i++)
+    putenv(req->env[i]);
+  if (req->cwd && chdir(req->cwd)) return 0;
+  return 1;
+}
+
+/* Send the time the child calls exec down the exec status pipe FD */
+static void
+exec_started(int fd)
+{
+  int err= errno;
+  struct timespec t;
+  if (fd < 0) return;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  write(fd, &t, sizeof(t));
+  errno= err;
+}
+
+/* Send errno down the exec status pipe FD, if the child's exec failed */
+static void
+exec_failed(int fd)
+{
+  int err= errno;
+  if (fd < 0) return;
+  signal(SIGPIPE, SIG_IGN);  /* parent may have exited */
+  write(fd, &err, sizeof(err));
+  errno= err;
+}
+
+/* The $PATH the child for REQ will search */
+static const char*
+request_path(const struct request* req)
+{
+  const char* path= NULL;
+  char** e;
+  size_t i;
+
+  if (!req) return getenv("PATH");
+  for (i= 0; i<req->nenv; i++)
+    if (!strncmp(req->env[i], "PATH=", 5)) path= req->env[i]+5;
+  if (path) return path;
+  if (!req->profile) return getenv("PATH");
+  for (e= req->profile->envp; e && *e; e++)
+    if (!strncmp(*e, "PATH=", 5)) return *e+5;
+  return NULL;
+}
+
+static int
+spawn(const struct request* req, size_t argc, char* const argv[], int show_err)
 {
   pid_t pid;
+  int fds[2], err, ok;
+
+  /* Find most failures here, so we don't have to wait for the exec */
+  if (!execpath_check(argv[0], request_path(req), req ? req->cwd : NULL)) {
+    err= errno;
+    fprintf(stderr, "%s: %s\n", myasctime(), escargs(argc, argv));
+    errno= err;
+    perror("  -> cannot run");
+    fflush(stderr);
+    request_errno= err;
+    return 0;
+  }
+  /* close-on-exec pipe, so the reaper can log an exec that fails anyway */
+  if (pipe2(fds, O_CLOEXEC|O_NONBLOCK)) fds[0]= fds[1]= -1;
   fflush(NULL);
   if ((pid= fork()) == 0) {
+    if (fds[0] >= 0) close(fds[0]);
 #ifdef __CYGWIN__
     if (!optH) {
       sigset_t sigset;
@@ -75,22 +952,33 @@ spawn(size_t argc, char* const argv[], int show_err)
         sigprocmask(SIG_BLOCK, &sigset, NULL);
     }
 #endif
-    execvp(argv[0], argv);
-    if (show_err) perror(argv[0]);
+    ok= apply_request(req, argv[0]);
+    exec_started(fds[1]);
+    if (ok) execvp(argv[0], argv);
+    exec_failed(fds[1]);
+    if (show_err && fds[1] < 0) perror(argv[0]);
     exit((errno == ENOENT) ? 127 : 126);
   } else if (pid == -1) {
+    err= errno;
+    if (fds[0] >= 0) {
+      close(fds[0]);
+      close(fds[1]);
+    }
     fprintf(stderr, "%s: %s\n", myasctime(), escargs(argc, argv));
+    errno= err;
     perror("  -> fork failed");
     fflush(stderr);
     return 0;
   }
+  if (fds[1] >= 0) close(fds[1]);
+  add_child(req, pid, argv[0], fds[0]);
   fprintf(stderr, "%s-%d: %s\n", myasctime(), pid, escargs(argc, argv));
   fflush(stderr);
   return 1;
 }
 
 static void
-do_exec(size_t argc, char* const argv[], int show_err)
+do_exec(const struct request* req, size_t argc, char* const argv[], int show_err)
 {
   fflush(NULL);
   if (!argc) exit(127);
@@ -106,28 +994,91 @@ do_exec(size_t argc, char* const argv[], int show_err)
     close(1);
     close(2);
   }
-  execvp(argv[0], argv);
+  if (apply_request(req, argv[0]))
+    execvp(argv[0], argv);
   if (show_err) perror(argv[0]);
   exit((errno == ENOENT) ? 127 : 126);
 }
 
+/* Point ARGV (size MAXARGS) at the arguments in packed request DATA,
+ * followed by a NULL and then its environment settings, and set REQ's cwd
+ * and env. Returns the number of arguments, or -1 if DATA is malformed
+ * or too long.
+ */
+static int
+unpack_args(struct request* req, const char* data, size_t ldata, char* argv[], size_t maxargs)
+{
+  size_t pos, n= 0, nenv= 0;
+  const char* v;
+  int type;
+
+  for (pos= ARGPACK_HDR; (type= argpack_next (data, ldata, &pos, &v)) > 0;) {
+    if (type == ARGPACK_ARG) {
+      if (n+1 >= maxargs) return -1;
+      argv[n++]= (char*) v;
+    } else if (type == ARGPACK_CWD) {
+      req->cwd= v;
+    }
+  }
+  if (type < 0) return -1;
+  argv[n]= NULL;
+  for (pos= ARGPACK_HDR; (type= argpack_next (data, ldata, &pos, &v)) > 0;) {
+    if (type != ARGPACK_ENV) continue;
+    if (n+1+nenv >= maxargs) return -1;
+    argv[n+1+nenv++]= (char*) v;
+  }
+  req->env= argv+n+1;
+  req->nenv= nenv;
+  return n;
+}
+
 static int
 run_cmd(const void *data, DWORD ldata, int use_exec)
 {
-  char *argv[1024], *argbuf;
+  char *argv[1024], *argbuf, **args= argv;
   int argc, ok= 0;
-  size_t largbuf;
+  size_t largbuf, nargs;
+  struct request req;
 
-  largbuf= strlen (data)+1;
-  argbuf= (char*) malloc (largbuf * sizeof(char));
-  argc= splitargs(data, argv, sizeof(argv)/sizeof(argv[0]), argbuf, largbuf);
+  clock_gettime(CLOCK_MONOTONIC, &req.received);
+  req.cwd= NULL;
+  req.env= NULL;
+  req.nenv= 0;
+  if (argpack_is(data, ldata)) {
+    /* already split: just copy, as [path] arguments are converted in place */
+    largbuf= ldata;
+    argbuf= (char*) malloc (largbuf * sizeof(char));
+    memcpy(argbuf, data, ldata);
+    argc= unpack_args(&req, argbuf, ldata, argv, sizeof(argv)/sizeof(argv[0]));
+    if (argc > 0 && expand_requested(argc, argv)) {
+      /* the words were split by the client, so there is nothing to expand */
+      fprintf(stderr, "%s: %s\n", myasctime(), escargs(argc, argv));
+      fprintf(stderr, "  -> command execution failed: \"!\" needs a text request\n");
+      fflush(stderr);
+      request_errno= EINVAL;
+      free(argbuf);
+      return 0;
+    }
+  } else {
+    largbuf= strlen (data)+1;
+    argbuf= (char*) malloc (largbuf * sizeof(char));
+    argc= splitargs(data, argv, sizeof(argv)/sizeof(argv[0]), argbuf, largbuf);
+    if (argc > 0 && expand_requested(argc, argv)) {
+      largbuf= expand_bufsize;
+      argbuf= (char*) realloc (argbuf, largbuf * sizeof(char));
+      argc= expandargs(data, argv, sizeof(argv)/sizeof(argv[0]), argbuf, largbuf);
+    }
+  }
+  nargs= (argc > 0) ? (size_t) argc : 0;
   if        (argc <  0) {
     if (!use_exec) {
-      fprintf(stderr, "%s: %s\n", myasctime(), (const char*) data);
+      fprintf(stderr, "%s: %s\n", myasctime(), argpack_is(data, ldata) ? "(packed request)" : (const char*) data);
       fprintf(stderr, "  -> command execution failed: too many command arguments\n");
       fflush(stderr);
     }
-  } else if (argc == 0) {
+  } else if (!parse_request(&req, &nargs, &args)) {
+    ok= 0;
+  } else if (nargs == 0) {
     if (!use_exec) {
       fprintf(stderr, "%s: null command ignored\n", myasctime());
       fflush(stderr);
@@ -137,20 +1088,20 @@ run_cmd(const void *data, DWORD ldata, int use_exec)
     char *argbuf2= NULL;
     size_t i, largbuf2= 0;
 
-    for (i= 0; i<argc; i++) {
-      if (argv[i][0] == '[') {
+    for (i= 0; i<nargs; i++) {
+      if (args[i][0] == '[') {
         size_t larg;
-        larg= strlen(argv[i]+1);   /* length-1 */
-        if (argv[i][larg] == ']') {
+        larg= strlen(args[i]+1);   /* length-1 */
+        if (args[i][larg] == ']') {
           char* p;
-          argv[i][larg]= '\0';
+          args[i][larg]= '\0';
           argbuf2= realloc(argbuf2, largbuf2+MAX_PATH);
           p= argbuf2+largbuf2;
-          cygwin_conv_path(CCP_WIN_A_TO_POSIX, argv[i]+1, p, MAX_PATH);
+          cygwin_conv_path(CCP_WIN_A_TO_POSIX, args[i]+1, p, MAX_PATH);
 #ifdef CYGLAUNCH_DEBUG
-          fprintf(stderr, "%s: \"%s\" -> \"%s\"\n", myasctime(), argv[i]+1, p);
+          fprintf(stderr, "%s: \"%s\" -> \"%s\"\n", myasctime(), args[i]+1, p);
 #endif
-          argv[i]= p;
+          args[i]= p;
           largbuf2 += strlen (p) + 1;
         }
       }
@@ -158,10 +1109,10 @@ run_cmd(const void *data, DWORD ldata, int use_exec)
 #endif
 
     if (use_exec) {
-      do_exec ((size_t) argc, argv, 0);
+      do_exec (&req, nargs, args, 0);
       ok= 0;
     } else {
-      ok= spawn((size_t) argc, argv, 1);
+      ok= spawn(&req, nargs, args, 1);
     }
 
 #ifdef __CYGWIN__
@@ -179,8 +1130,9 @@ execHandler(const void *data, DWORD ldata)
   return run_cmd (data, ldata, 0);
 }
 
+/* Run CYGLAUNCHER_EXIT_CMD, in place of this process unless ASYNC */
 static int
-run_exit_cmd()
+run_exit_cmd(int async)
 {
   const char* data;
   const char* envcmd;
@@ -190,19 +1142,170 @@ run_exit_cmd()
   } else {
     data= exit_cmd;
   }
-  return run_cmd (data, strlen(data), 1);
+  return run_cmd (data, strlen(data), !async);
+}
+
+static int
+refreshHandler(const void *data, DWORD ldata)
+{
+  char *argv[sizeof(profiles)/sizeof(profiles[0])+1], *argbuf;
+  int argc, ok= 1;
+  size_t largbuf, i;
+
+  largbuf= strlen (data)+1;
+  argbuf= (char*) malloc (largbuf * sizeof(char));
+  argc= splitargs(data, argv, sizeof(argv)/sizeof(argv[0]), argbuf, largbuf);
+  if (argc < 0) {
+    ok= 0;
+  } else if (argc == 0) {
+    for (i= 0; i<nprofiles; i++)
+      if (!capture_profile (&profiles[i])) ok= 0;
+  } else {
+    for (i= 0; i<argc; i++) {
+      struct profile* pr= find_profile (argv[i]);
+      if (!pr) {
+        fprintf(stderr, "%s: refresh: unknown profile: %s\n", myasctime(), argv[i]);
+        fflush(stderr);
+        ok= 0;
+      } else if (!capture_profile (pr)) {
+        ok= 0;
+      }
+    }
+  }
+  free(argbuf);
+  return ok;
+}
+
+/* Returns a report of per-command statistics in a malloc'ed string */
+static char*
+stats_report()
+{
+  char *report, *s;
+  size_t l;
+
+  reap_children();
+  report= history_report();
+  l= strlen (report);
+  s= (char*) realloc (report, l+64);
+  snprintf (s+l, 64, "%lu running\n", (unsigned long) nchildren);
+  return s;
+}
+
+static int
+statsHandler(const void *data, DWORD ldata)
+{
+  char* report= stats_report();
+  fprintf(stderr, "%s: statistics\n%s", myasctime(), report);
+  fflush(stderr);
+  free(report);
+  return 1;
 }
 
 static int
 exitHandler(const void *data, DWORD ldata)
 {
-  PostQuitMessage(0);
+  if (data && ldata >= 5 && !strncmp (data, "drain", 5) && (ldata == 5 || !((const char*) data)[5])) {
+    start_drain();
+  } else {
+    draining= 0;
+    PostQuitMessage(0);
+  }
   return 1;
 }
 
 
-static const char*            topics[]=        {"exec",       "exit"      };
-static const topicHandlerType topicHandlers[]= {&execHandler, &exitHandler};
+/* Pass a request to HANDLER, recording it in the trace file (if any) */
+static int
+handleRequest(const char* topic, topicHandlerType handler, const void *data, DWORD ldata)
+{
+  struct trace_record r;
+  struct timespec t0, t1;
+  int ok;
+
+  request_errno= 0;
+  /* DdeConnect to us blocks until we return, so tell clients that can go elsewhere */
+  if (busyEvent) SetEvent(busyEvent);
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  ok= handler(data, ldata);
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  if (busyEvent) ResetEvent(busyEvent);
+  if (!tracefile) return ok;
+  r.time=    t0.tv_sec * 1000000000ULL + t0.tv_nsec;
+  r.service= (t1.tv_sec - t0.tv_sec) * 1000000000LL + (t1.tv_nsec - t0.tv_nsec);
+  strncpy(r.topic, topic, sizeof(r.topic)-1);
+  r.topic[sizeof(r.topic)-1]= '\0';
+  r.ldata= data ? ldata : 0;
+  r.data= (char*) data;
+  if (!trace_write(tracefile, &r)) {
+    fprintf(stderr, "%s: ", myasctime());
+    perror("trace file write failed");
+    fflush(stderr);
+    fclose(tracefile);
+    tracefile= NULL;
+  }
+  return ok;
+}
+
+static int
+ringHandler(const void *data, unsigned long ldata)
+{
+  if (handleRequest("exec", execHandler, data, (DWORD) ldata)) return SHMRING_OK;
+  return request_errno ? (SHMRING_ERRNO | (request_errno & (SHMRING_ERRNO-1))) : 0;
+}
+
+/* Wake the main thread when requests arrive in the ring, then wait
+ * for it to handle them all before waiting again.
+ */
+static void*
+ringThread(void* arg)
+{
+  while (shmring_wait(ring)) {
+    if (!PostThreadMessage(mainThread, WM_RING, 0, 0)) {
+      perrorWin("PostThreadMessage error", GetLastError());
+      break;
+    }
+    while (sem_wait(&ring_drained) && errno == EINTR) ;
+  }
+  return NULL;
+}
+
+static int
+start_ring()
+{
+  if (!(ring= shmring_create(shmring_name(instance)))) {
+    if (errno == EEXIST)
+      fprintf(stderr, "%s: request ring %s is in use by another cyglauncher\n", myasctime(), shmring_name(instance));
+    else {
+      fprintf(stderr, "%s: ", myasctime());
+      perror("cannot create request ring");
+    }
+    fflush(stderr);
+    return 0;
+  }
+  sem_init(&ring_drained, 0, 0);
+  if (pthread_create(&ring_thread, NULL, ringThread, NULL)) {
+    shmring_close(ring);
+    ring= NULL;
+    return 0;
+  }
+  return 1;
+}
+
+/* Stop the ring thread, then close the ring it was using */
+static void
+stop_ring()
+{
+  if (!ring) return;
+  shmring_stop(ring);
+  sem_post(&ring_drained);  /* in case it is waiting for us to drain */
+  pthread_join(ring_thread, NULL);
+  shmring_close(ring);
+  ring= NULL;
+}
+
+
+static const char*            topics[]=        {"exec",       "exit",       "refresh",       "stats"      };
+static const topicHandlerType topicHandlers[]= {&execHandler, &exitHandler, &refreshHandler, &statsHandler};
 static const size_t ntopics= sizeof(topics)/sizeof(topics[0]);
 
 
@@ -243,6 +1346,15 @@ DdeServerProc (
             return (HDDEDATA) FALSE;
         }
 
+        case XTYP_CONNECT_CONFIRM:
+            nconversations++;
+            return NULL;
+
+        case XTYP_DISCONNECT:
+            nconversations--;
+            check_drained();
+            return NULL;
+
         case XTYP_EXECUTE: {
 
             /*
@@ -261,8 +1373,10 @@ DdeServerProc (
 
             for (i= 0; i<ntopics; i++) {
               if (!strcmp (topic, topics[i])) {
-                if ((topicHandlers[i])(data, ldata))
+                if (handleRequest(topics[i], topicHandlers[i], data, ldata))
                   ret= (HDDEDATA) DDE_FACK;
+                else if (request_errno)  /* tell the client why */
+                  ret= (HDDEDATA) (DWORD_PTR) (DDE_FNOTPROCESSED | (request_errno & DDE_APPSTATUS));
                 break;
               }
             }
@@ -270,6 +1384,23 @@ DdeServerProc (
             return ret;
         }
 
+        case XTYP_REQUEST: {
+
+            /*
+             * Return the current statistics as text.
+             */
+            char topic[256];
+            char* report;
+            HDDEDATA ret;
+
+            DdeQueryString(ddeInstance, ddeTopic, topic, sizeof(topic), CP_WINANSI);
+            if (strcmp (topic, "stats")) return NULL;
+            report= stats_report();
+            ret= DdeCreateDataHandle(ddeInstance, (LPBYTE) report, strlen(report)+1, 0, ddeItem, CF_TEXT, 0);
+            free(report);
+            return ret;
+        }
+
         case XTYP_WILDCONNECT: {
 
             /*
@@ -297,13 +1428,86 @@ DdeServerProc (
 }
 
 
+/* Instance names become part of DDE service, shared memory, and file names */
+static int
+valid_instance(const char* name)
+{
+  const char* p;
+  if (!*name || strlen(name) > 32) return 0;
+  for (p= name; *p; p++)
+    if (!isalnum((unsigned char) *p) && !strchr("-_.", *p)) return 0;
+  return 1;
+}
+
+static int
+parsenum(const char* arg, size_t* val)
+{
+  char* end;
+  unsigned long n= strtoul(arg, &end, 10);
+  if (end == arg || *end) return 0;
+  *val= n;
+  return 1;
+}
+
+
+/* Parse option letter at P. An option argument is taken from the rest of P,
+ * or else from *OPTARG (which is then set to NULL to show it was used).
+ */
 static const char*
-parseopt(const char* p)
+parseopt(const char* p, const char** optarg)
 {
-  switch (*p++) {
+  static const char optargs[]= "aDnpwWT";  /* options that take an argument */
+  const char* arg= NULL;
+  const char* err;
+  char opt= *p++;
+
+  if (opt && strchr(optargs, opt)) {
+    if (*p) {
+      arg= p;
+      p += strlen(p);
+    } else if (*optarg) {
+      arg= *optarg;
+      *optarg= NULL;
+    } else {
+      return NULL;
+    }
+  }
+  switch (opt) {
   case 'H':
     optH= 1;
     break;
+  case 'R':
+    optR= 1;
+    break;
+  case 'T':
+    if (tracefile) fclose(tracefile);
+    if (!(tracefile= trace_create(arg))) {
+      perror(arg);
+      return NULL;
+    }
+    break;
+  case 'D':
+    if (!parsenum (arg, &drain_timeout)) return NULL;
+    break;
+  case 'a':
+    if ((err= parse_attrs (arg, &default_attrs))) {
+      fprintf(stderr, "%s: %s\n", prog, err);
+      return NULL;
+    }
+    break;
+  case 'n':
+    if (!valid_instance (arg)) return NULL;
+    instance= arg;
+    break;
+  case 'p':
+    if (!add_profile (arg)) return NULL;
+    break;
+  case 'w':
+    if (!parsenum (arg, &prewarm_count)) return NULL;
+    break;
+  case 'W':
+    if (!parsenum (arg, &prewarm_budget)) return NULL;
+    break;
   case 'h':
   case '?':
     opth= 1;
@@ -318,7 +1522,7 @@ parseopt(const char* p)
 static int
 usage()
 {
-  fprintf(stderr, "Usage: %s [-H] [COMMAND]\n", prog);
+  fprintf(stderr, "Usage: %s [-H] [-n INSTANCE] [-a ATTRS] [-p NAME[=SETUP]]... [-w NCMDS] [-W MBYTES] [-R] [-T TRACE] [-D SECS] [COMMAND]\n", prog);
   return 1;
 }
 
@@ -330,29 +1534,64 @@ main (int argc, char* argv[])
   HSZ ddeService= 0;
   MSG msg;
   BOOL bRet;
-  size_t i;
+  size_t i, j;
   const char* envcmd;
 
   prog= argv[0];
+  clock_gettime(CLOCK_MONOTONIC, &wheel_start);
 
   for (i= 1; i < argc; i++) {
-    const char* p;
+    const char *p, *next;
     if (argv[i][0] != '-') break;
     if (argv[i][1] == '-' && argv[i][2] == '\0') {
       i++;
       break;
     }
+    next= (i+1 < argc) ? argv[i+1] : NULL;
     for (p= argv[i]+1; *p;) {
-      p= parseopt(p);
+      p= parseopt(p, &next);
       if (!p) {
         fprintf(stderr, "%s: invalid option: %s\n", prog, argv[i]);
         return 2;
       }
     }
+    if (i+1 < argc && !next) i++;
   }
 
   if (opth) return usage();
 
+  if (!instance && (envcmd= getenv(instance_envvar)) && *envcmd) {
+    if (!valid_instance (envcmd)) {
+      fprintf(stderr, "%s: invalid %s: %s\n", prog, instance_envvar, envcmd);
+      return 2;
+    }
+    instance= strdup (envcmd);
+  }
+  unsetenv(instance_envvar);  /* not for our children */
+  if (instance)
+    snprintf(ddeServiceName, sizeof(ddeServiceName), "cyglaunch-%s", instance);
+
+  for (j= 0; j<nprofiles; j++)
+    capture_profile (&profiles[j]);
+
+  if ((envcmd= getenv(history_envvar))) {
+    if (*envcmd) history_path= strdup (envcmd);
+  } else if ((envcmd= getenv("HOME"))) {
+    history_path= (char*) malloc (strlen(envcmd) + sizeof(history_file) + 1);
+    sprintf (history_path, "%s/%s", envcmd, history_file);
+  }
+  if (history_path && instance) {  /* each instance keeps its own history */
+    history_path= (char*) realloc (history_path, strlen(history_path) + strlen(instance) + 2);
+    strcat (history_path, "-");
+    strcat (history_path, instance);
+  }
+  if (history_path) history_load (history_path);
+  if (prewarm_count > 0) {
+    char** paths= (char**) malloc (prewarm_count * sizeof(char*));
+    prewarm_start (paths, history_top (paths, prewarm_count), prewarm_budget << 20);
+    free(paths);
+  }
+
   if ((envcmd= getenv(cmd_envvar))) {
     size_t lcmd= strlen(envcmd);
     char* cmd= (char*) malloc(lcmd+1);
@@ -362,10 +1601,10 @@ main (int argc, char* argv[])
   }
 
   if (argc > i)
-    spawn (argc-i, argv+i, 1);
+    spawn (NULL, argc-i, argv+i, 1);
 
   err= DdeInitialize(&ddeInstance, DdeServerProc,
-                     CBF_SKIP_ALLNOTIFICATIONS | CBF_FAIL_POKES | CBF_FAIL_REQUESTS, 0);
+                     CBF_SKIP_REGISTRATIONS | CBF_SKIP_UNREGISTRATIONS | CBF_FAIL_POKES, 0);
   if (err != DMLERR_NO_ERROR) {
     perrorWin("DdeInitialize error", GetLastError());
     return 1;
@@ -373,6 +1612,23 @@ main (int argc, char* argv[])
 
   ddeService= DdeCreateStringHandle(ddeInstance, (LPTSTR) ddeServiceName, 0);
   DdeNameService(ddeInstance, ddeService, 0L, DNS_REGISTER);
+  {
+    char busyName[sizeof(ddeServiceName)+5];
+    snprintf(busyName, sizeof(busyName), "%s-busy", ddeServiceName);
+    if (!(busyEvent= CreateEvent(NULL, TRUE, FALSE, busyName)))
+      perrorWin("CreateEvent error", GetLastError());  /* not fatal: clients just can't fail over */
+  }
+  SetTimer(NULL, 0, reap_interval, reapTimer);
+  mainThread= GetCurrentThreadId();
+  {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler= childExited;
+    sa.sa_flags= SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGCHLD, &sa, NULL);
+  }
+  if (optR) start_ring();
 
   while ((bRet= GetMessage(&msg, NULL, 0, 0)) != 0) {
     if (bRet == -1) {
@@ -380,13 +1636,35 @@ main (int argc, char* argv[])
       msg.wParam= 2;
       break;
     }
+    if (msg.hwnd == NULL && msg.message == WM_RING) {
+      shmring_drain(ring, ringHandler);
+      sem_post(&ring_drained);
+      check_drained();
+      continue;
+    }
+    if (msg.hwnd == NULL && msg.message == WM_REAP) {
+      reap_children();
+      continue;
+    }
     TranslateMessage(&msg);
     DispatchMessage(&msg);
   }
 
   fprintf (stderr, "%s: Exit\n", myasctime());
   DdeNameService(ddeInstance, 0L, 0L, DNS_UNREGISTER);
+  stop_ring();
   DdeUninitialize(ddeInstance);
-  run_exit_cmd();
+  reap_children();
+  save_history();
+  if (msg.message == WM_QUIT && msg.wParam == 1) {
+    /* drained: log the final state, and leave the exit command running */
+    char* report= stats_report();
+    fprintf(stderr, "%s: statistics\n%s", myasctime(), report);
+    free(report);
+    log_children();
+    run_exit_cmd(1);
+    return 0;
+  }
+  run_exit_cmd(0);
   return msg.wParam;
 }
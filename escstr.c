@@ -14,6 +14,10 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#ifndef _WIN32
+#include <glob.h>
+#include <pwd.h>
+#endif
 
 #include "escstr.h"
 
@@ -117,6 +121,42 @@ escargs(size_t argc, char* const argv[])
 }
 
 
+/* Decode the escape sequence starting with the backslash at *PP, leaving
+ * *PP pointing to its last character.
+ */
+static char
+unescape (const char** pp)
+{
+  const char* p= *pp;
+  int c2;
+  char c, *r;
+  char num[4];
+
+  c= *(++p);
+  if (c == '\0') return '\\';   /* trailing backslash */
+  if (c == 'x') {
+    strncpy (num, p+1, 2); num[2]= '\0';
+    c2= (unsigned char) strtol (num, &r, 16);
+    if (c2 && r && r>num) {
+      p += r-num;
+      c= c2;
+    }
+  } else if (isdigit (c)) {
+    strncpy (num, p, 3); num[3]= '\0';
+    c2= (unsigned char) strtol (num, &r, 8);
+    if (c2 && r && r>num) {
+      p += r-num-1;
+      c= c2;
+    }
+  } else {
+    r= strchr (escname, c);
+    if (r) c= escchar[r-escname];
+  }
+  *pp= p;
+  return c;
+}
+
+
 /* Separate STR into arguments, respecting quote and escaped characters.
  * Returns the number of arguments (or < 0 if limits are passed), which are
  * copied into BUF and referenced from ARGV.
@@ -142,28 +182,7 @@ splitargs (const char* s, char* argv[], size_t maxargs,
       sp= 0;
     }
     if        (c == '\\' && quote != '\'') {
-      int c2;
-      char* r;
-      char num[4];
-      c= *(++p);
-      if (c == 'x') {
-        strncpy (num, p+1, 2); num[2]= '\0';
-        c2= (unsigned char) strtol (num, &r, 16);
-        if (c2 && r && r>num) {
-          p += r-num;
-          c= c2;
-        }
-      } else if (isdigit (c)) {
-        strncpy (num, p, 3); num[3]= '\0';
-        c2= (unsigned char) strtol (num, &r, 8);
-        if (c2 && r && r>num) {
-          p += r-num-1;
-          c= c2;
-        }
-      } else {
-        r= strchr (escname, c);
-        if (r) c= escchar[r-escname];
-      }
+      c= unescape (&p);
     } else if (quote) {
       if (c == quote) {
           quote= 0;
@@ -183,3 +202,149 @@ splitargs (const char* s, char* argv[], size_t maxargs,
   argv[argc]= NULL;
   return argc;
 }
+
+
+#ifndef _WIN32
+/* Add character C to the word in BUF, and to the glob pattern PAT, escaped
+ * there if it is special and LIT (quoted or the result of an expansion).
+ */
+#define ADDCHAR(c,lit) do {                                   \
+    if (i >= maxbuf) goto toolong;                            \
+    buf[i++]= (c);                                            \
+    if ((lit) && strchr ("*?[\\", (c))) pat[j++]= '\\';       \
+    pat[j++]= (c);                                            \
+  } while (0)
+
+/* Like splitargs, but also expands each word as a POSIX shell would:
+ * a leading ~ or ~USER, $NAME or ${NAME} from the environment, and
+ * *, ?, and [...] patterns matching file names. Quoted or escaped characters
+ * are not expanded, except for $ inside double quotes.
+ * Unlike the shell, expanded values are not split into words or globbed.
+ */
+int
+expandargs (const char* s, char* argv[], size_t maxargs,
+            char* buf, size_t maxbuf)
+{
+  char c, quote= 0, *pat;
+  const char *p, *q, *v;
+  size_t argc= 0, i= 0, j= 0, start= 0, k;
+  int inword= 0, quoted= 0, magic= 0, expanded= 0;
+
+  if (!argv) return -1;
+  if (!buf)  return -2;
+  maxargs--;   /* leave room for final NULL */
+  pat= (char*) malloc (2*maxbuf+1);
+  for (p= s;; p++) {
+    c= *p;
+    if (!inword) {
+      if (c == '\0') break;
+      if (isspace (c)) continue;
+      inword= 1;
+      start= i;
+      j= quoted= magic= expanded= 0;
+      if (c == '~') {
+        for (q= p+1; *q && *q != '/' && !isspace (*q) && !strchr ("\\\'\"$", *q); q++) ;
+        if (*q == '\0' || *q == '/' || isspace (*q)) {
+          char user[256];
+          struct passwd* pw;
+          k= q-p-1;
+          if (k == 0) {
+            v= getenv ("HOME");
+          } else if (k < sizeof(user)) {
+            memcpy (user, p+1, k);
+            user[k]= '\0';
+            v= (pw= getpwnam (user)) ? pw->pw_dir : NULL;
+          } else {
+            v= NULL;
+          }
+          if (v) {
+            for (; *v; v++) ADDCHAR (*v, 1);
+            expanded= 1;
+            p= q-1;
+            continue;
+          }
+        }
+      }
+    }
+
+    if (c == '\0' || (!quote && isspace (c))) {  /* end of word */
+      glob_t g;
+      if (i >= maxbuf) goto toolong;
+      buf[i]= '\0';
+      pat[j]= '\0';
+      inword= 0;
+      if (!quoted && expanded && i == start) {
+        /* unquoted empty expansion: no word */
+      } else if (magic && glob (pat, 0, NULL, &g) == 0) {
+        i= start;
+        for (k= 0; k<g.gl_pathc; k++) {
+          size_t l= strlen (g.gl_pathv[k]) + 1;
+          if (argc >= maxargs) {
+            globfree (&g);
+            goto toomany;
+          }
+          if (i+l > maxbuf) {
+            globfree (&g);
+            goto toolong;
+          }
+          memcpy (buf+i, g.gl_pathv[k], l);
+          argv[argc++]= &buf[i];
+          i += l;
+        }
+        globfree (&g);
+      } else {
+        if (argc >= maxargs) goto toomany;
+        argv[argc++]= &buf[start];
+        i++;
+      }
+      if (c == '\0') break;
+      continue;
+    }
+
+    if        (c == '\\' && quote != '\'') {
+      c= unescape (&p);
+      ADDCHAR (c, 1);
+    } else if (c == '$' && quote != '\'') {
+      char name[256];
+      v= (p[1] == '{') ? p+2 : p+1;
+      for (q= v; *q == '_' || isalnum (*q); q++) ;
+      k= q-v;
+      if (isdigit (*v)) k= 0;             /* positional parameters not supported */
+      if (p[1] == '{' && *q != '}') k= 0;
+      if (!k || k >= sizeof(name)) {
+        ADDCHAR (c, quote);
+        continue;
+      }
+      memcpy (name, v, k);
+      name[k]= '\0';
+      if ((v= getenv (name))) {
+        for (; *v; v++) ADDCHAR (*v, 1);
+      }
+      expanded= 1;
+      p= (p[1] == '{') ? q : q-1;   /* only ${NAME} has a } to skip */
+    } else if (quote) {
+      if (c == quote) {
+        quote= 0;
+        continue;
+      }
+      ADDCHAR (c, 1);
+    } else if (c == '\'' || c == '\"') {
+      quote= c;
+      quoted= 1;
+    } else {
+      if (strchr ("*?[", c)) magic= 1;
+      ADDCHAR (c, 0);
+    }
+  }
+  free (pat);
+  argv[argc]= NULL;
+  return argc;
+
+toomany:
+  free (pat);
+  return -1;
+toolong:
+  free (pat);
+  return -2;
+}
+#endif
@@ -0,0 +1,94 @@
+/*
+ * execpath.c - check a command can be run before starting it
+ *
+ * Copyright (c) 2004 by Tim Adye <T.J.Adye@rl.ac.uk>.
+ * Permission to use, copy, modify, and distribute this software and its
+ * documentation for any purpose and without fee is hereby granted,
+ * provided that the above copyright notice appears in all copies.
+ * If this software is included in another package, acknowledgement
+ * in the supporting documentation is requested, but not required.
+ * This software is provided "as is" without express or implied warranty.
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "execpath.h"
+
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
+
+static const char default_path[]= "/bin:/usr/bin";  /* execvp's, if there is no $PATH */
+
+/* Is NAME in directory DIR (LDIR chars of it, none for NAME itself) an
+ * executable file? A relative path is taken from CWD, if set.
+ */
+static int
+try_file(const char* cwd, const char* dir, size_t ldir, const char* name)
+{
+  char buf[PATH_MAX];
+  struct stat st;
+  int n;
+
+  if (cwd && (ldir ? dir[0] : name[0]) != '/')
+    n= snprintf(buf, sizeof(buf), "%s/%.*s%s%s", cwd, (int) ldir, dir, ldir ? "/" : "", name);
+  else
+    n= snprintf(buf, sizeof(buf), "%.*s%s%s", (int) ldir, dir, ldir ? "/" : "", name);
+  if (n < 0 || (size_t) n >= sizeof(buf)) {
+    errno= ENAMETOOLONG;
+    return 0;
+  }
+  if (access(buf, X_OK)) return 0;
+  if (!stat(buf, &st) && S_ISDIR(st.st_mode)) {
+    errno= EACCES;
+    return 0;
+  }
+  return 1;
+}
+
+/* Check whether execvp could run NAME, searching PATH (or execvp's default
+ * if NULL), from directory CWD (or the current directory if NULL).
+ * Returns 1 if it could, or 0 with errno set to the reason it could not.
+ * The child can still fail (eg. a bad interpreter), but this catches the
+ * usual mistakes without waiting for it.
+ */
+int
+execpath_check(const char* name, const char* path, const char* cwd)
+{
+  const char *p, *q;
+  struct stat st;
+  size_t l;
+  int err= ENOENT;
+
+  if (cwd) {
+    if (stat(cwd, &st)) return 0;
+    if (!S_ISDIR(st.st_mode)) {
+      errno= ENOTDIR;
+      return 0;
+    }
+    if (access(cwd, X_OK)) return 0;
+  }
+  if (!*name) {
+    errno= ENOENT;
+    return 0;
+  }
+  if (strchr(name, '/'))
+    return try_file(cwd, "", 0, name);
+  if (!path) path= default_path;
+  for (p= path;; p= q+1) {
+    q= strchr(p, ':');
+    l= q ? (size_t) (q-p) : strlen(p);
+    /* an empty entry means the current directory */
+    if (l ? try_file(cwd, p, l, name) : try_file(cwd, ".", 1, name))
+      return 1;
+    if (errno == EACCES) err= EACCES;  /* like execvp, report EACCES if nothing else was found */
+    if (!q) break;
+  }
+  errno= err;
+  return 0;
+}
@@ -0,0 +1,18 @@
+/*
+ * execpath.h - check a command can be run before starting it
+ *
+ * Copyright (c) 2004 by Tim Adye <T.J.Adye@rl.ac.uk>.
+ * Permission to use, copy, modify, and distribute this software and its
+ * documentation for any purpose and without fee is hereby granted,
+ * provided that the above copyright notice appears in all copies.
+ * If this software is included in another package, acknowledgement
+ * in the supporting documentation is requested, but not required.
+ * This software is provided "as is" without express or implied warranty.
+ */
+
+#ifndef EXECPATH_H
+#define EXECPATH_H
+
+extern int execpath_check(const char* name, const char* path, const char* cwd);
+
+#endif /* EXECPATH_H */
@@ -0,0 +1,219 @@
+/*
+ * history.c - per-command resource accounting
+ *
+ * Copyright (c) 2004 by Tim Adye <T.J.Adye@rl.ac.uk>.
+ * Permission to use, copy, modify, and distribute this software and its
+ * documentation for any purpose and without fee is hereby granted,
+ * provided that the above copyright notice appears in all copies.
+ * If this software is included in another package, acknowledgement
+ * in the supporting documentation is requested, but not required.
+ * This software is provided "as is" without express or implied warranty.
+ */
+
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "escstr.h"
+#include "history.h"
+
+/* Totals for all runs of one command */
+struct history_entry {
+  char*  name;
+  char*  path;              /* most recent argv[0] used for this command */
+  unsigned long count, failed;
+  double utime, stime, wall, latency;
+  long   maxrss;
+};
+
+static const char history_magic[]= "# cyglauncher history 1";
+static struct history_entry* entries= NULL;
+static size_t nentries= 0, maxentries= 0;
+int history_dirty= 0;
+
+
+/* history_name returns the command name used to aggregate CMD: its
+ * basename, without any ".exe" suffix.
+ */
+const char*
+history_name (const char* cmd)
+{
+  static char buf[256];
+  const char *p;
+  size_t l;
+
+  for (p= cmd + strlen (cmd); p > cmd && p[-1] != '/' && p[-1] != '\\'; p--) ;
+  l= strlen (p);
+  if (l > 4 && !strcasecmp (p+l-4, ".exe")) l -= 4;
+  if (l >= sizeof(buf)) l= sizeof(buf)-1;
+  memcpy (buf, p, l);
+  buf[l]= '\0';
+  return buf;
+}
+
+
+static struct history_entry*
+history_find (const char* name, const char* path)
+{
+  struct history_entry* e;
+  size_t i;
+
+  for (i= 0; i<nentries; i++) {
+    if (!strcmp (entries[i].name, name))
+      return &entries[i];
+  }
+  if (nentries >= maxentries) {
+    maxentries= maxentries ? 2*maxentries : 64;
+    entries= (struct history_entry*) realloc (entries, maxentries * sizeof(*entries));
+  }
+  e= &entries[nentries++];
+  memset (e, 0, sizeof(*e));
+  e->name= strdup (name);
+  e->path= strdup (path);
+  return e;
+}
+
+
+void
+history_record (const char* name, const char* path, const struct history_sample* s)
+{
+  struct history_entry* e;
+
+  e= history_find (name, path);
+  if (strcmp (e->path, path)) {
+    free (e->path);
+    e->path= strdup (path);
+  }
+  e->count++;
+  if (s->failed) e->failed++;
+  e->utime   += s->utime;
+  e->stime   += s->stime;
+  e->wall    += s->wall;
+  e->latency += s->latency;
+  if (s->maxrss > e->maxrss) e->maxrss= s->maxrss;
+  history_dirty= 1;
+}
+
+
+/* Read totals saved by history_save, adding them to those already recorded.
+ * Returns 0 if the file could not be read.
+ */
+int
+history_load (const char* file)
+{
+  char line[8192], buf[8192], *argv[10];
+  FILE* f;
+  int argc;
+
+  if (!(f= fopen (file, "r"))) return 0;
+  if (!fgets (line, sizeof(line), f) || strncmp (line, history_magic, sizeof(history_magic)-1)) {
+    fclose (f);
+    return 0;
+  }
+  while (fgets (line, sizeof(line), f)) {
+    struct history_entry* e;
+    long maxrss;
+    argc= splitargs (line, argv, sizeof(argv)/sizeof(argv[0]), buf, sizeof(buf));
+    if (argc != 9) continue;
+    e= history_find (argv[0], argv[1]);
+    e->count   += strtoul (argv[2], NULL, 10);
+    e->failed  += strtoul (argv[3], NULL, 10);
+    e->utime   += strtod  (argv[4], NULL);
+    e->stime   += strtod  (argv[5], NULL);
+    e->wall    += strtod  (argv[6], NULL);
+    e->latency += strtod  (argv[7], NULL);
+    maxrss= strtol (argv[8], NULL, 10);
+    if (maxrss > e->maxrss) e->maxrss= maxrss;
+  }
+  fclose (f);
+  return 1;
+}
+
+
+/* Write all totals to FILE, one command per line, replacing it atomically. */
+int
+history_save (const char* file)
+{
+  char* tmp;
+  FILE* f;
+  size_t i;
+  int ok;
+
+  tmp= (char*) malloc (strlen (file) + 5);
+  strcpy (tmp, file);
+  strcat (tmp, ".tmp");
+  if (!(f= fopen (tmp, "w"))) {
+    free (tmp);
+    return 0;
+  }
+  fprintf (f, "%s\n", history_magic);
+  for (i= 0; i<nentries; i++) {
+    const struct history_entry* e= &entries[i];
+    fprintf (f, "%s", escstr (e->name));
+    fprintf (f, " %s %lu %lu %.3f %.3f %.3f %.6f %ld\n",
+             escstr (e->path), e->count, e->failed,
+             e->utime, e->stime, e->wall, e->latency, e->maxrss);
+  }
+  ok= !ferror (f);
+  if (fclose (f)) ok= 0;
+  if (ok && rename (tmp, file)) ok= 0;
+  if (!ok) remove (tmp);
+  free (tmp);
+  if (ok) history_dirty= 0;
+  return ok;
+}
+
+
+static int
+history_cmp (const void* a, const void* b)
+{
+  const struct history_entry *ea= *(const struct history_entry* const*) a;
+  const struct history_entry *eb= *(const struct history_entry* const*) b;
+  return (eb->count > ea->count) - (eb->count < ea->count);
+}
+
+
+/* history_top fills PATHS with malloc'ed copies of the paths of (up to) the N
+ * most frequently launched commands, most frequent first, and returns how
+ * many there are.
+ */
+size_t
+history_top (char* paths[], size_t n)
+{
+  struct history_entry** sorted;
+  size_t i;
+
+  if (n > nentries) n= nentries;
+  if (!n) return 0;
+  sorted= (struct history_entry**) malloc (nentries * sizeof(*sorted));
+  for (i= 0; i<nentries; i++) sorted[i]= &entries[i];
+  qsort (sorted, nentries, sizeof(*sorted), history_cmp);
+  for (i= 0; i<n; i++) paths[i]= strdup (sorted[i]->path);
+  free (sorted);
+  return n;
+}
+
+
+/* history_report returns a table of per-run averages for each command,
+ * in a malloc'ed string.
+ */
+char*
+history_report (void)
+{
+  char *buf;
+  size_t lbuf, n, i;
+
+  lbuf= (nentries+1) * 128 + 1;
+  buf= (char*) malloc (lbuf);
+  n= snprintf (buf, lbuf, "%-24s %6s %5s %9s %9s %10s %10s %9s\n",
+               "command", "runs", "fail", "user(s)", "sys(s)", "wall(s)", "launch(ms)", "maxrss(K)");
+  for (i= 0; i<nentries && n<lbuf; i++) {
+    const struct history_entry* e= &entries[i];
+    double c= e->count ? (double) e->count : 1.0;
+    n += snprintf (buf+n, lbuf-n, "%-24.24s %6lu %5lu %9.3f %9.3f %10.1f %10.2f %9ld\n",
+                   e->name, e->count, e->failed, e->utime/c, e->stime/c,
+                   e->wall/c, 1000.0*e->latency/c, e->maxrss);
+  }
+  return buf;
+}
@@ -0,0 +1,34 @@
+/*
+ * history.h - per-command resource accounting
+ *
+ * Copyright (c) 2004 by Tim Adye <T.J.Adye@rl.ac.uk>.
+ * Permission to use, copy, modify, and distribute this software and its
+ * documentation for any purpose and without fee is hereby granted,
+ * provided that the above copyright notice appears in all copies.
+ * If this software is included in another package, acknowledgement
+ * in the supporting documentation is requested, but not required.
+ * This software is provided "as is" without express or implied warranty.
+ */
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+/* Resources used by one launched command */
+struct history_sample {
+  int    failed;    /* exited with non-zero status or signal */
+  double utime;     /* user CPU, seconds */
+  double stime;     /* system CPU, seconds */
+  double wall;      /* wall clock, seconds */
+  double latency;   /* request received -> command exec'd, seconds */
+  long   maxrss;    /* maximum resident set size, KB */
+};
+
+extern int         history_dirty;
+extern const char* history_name(const char* cmd);
+extern void        history_record(const char* name, const char* path, const struct history_sample* s);
+extern int         history_load(const char* file);
+extern int         history_save(const char* file);
+extern size_t      history_top(char* paths[], size_t n);
+extern char*       history_report(void);
+
+#endif /* HISTORY_H */
@@ -0,0 +1,269 @@
+/*
+ * prewarm.c - background prefetch of frequently launched programs
+ *
+ * Copyright (c) 2004 by Tim Adye <T.J.Adye@rl.ac.uk>.
+ * Permission to use, copy, modify, and distribute this software and its
+ * documentation for any purpose and without fee is hereby granted,
+ * provided that the above copyright notice appears in all copies.
+ * If this software is included in another package, acknowledgement
+ * in the supporting documentation is requested, but not required.
+ * This software is provided "as is" without express or implied warranty.
+ */
+
+#define _GNU_SOURCE  /* strcasestr */
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#ifdef __CYGWIN__
+#include <windows.h>
+#endif
+
+#include "prewarm.h"
+
+/* Files still to read, and all those already seen */
+struct prewarm {
+  char** files;
+  size_t nfiles, maxfiles, next;
+  size_t budget, used;
+};
+
+
+static void
+add_file (struct prewarm* pw, char* path)
+{
+  size_t i;
+  for (i= 0; i<pw->nfiles; i++) {
+    if (!strcasecmp (pw->files[i], path)) {
+      free (path);
+      return;
+    }
+  }
+  if (pw->nfiles >= pw->maxfiles) {
+    pw->maxfiles= pw->maxfiles ? 2*pw->maxfiles : 64;
+    pw->files= (char**) realloc (pw->files, pw->maxfiles * sizeof(char*));
+  }
+  pw->files[pw->nfiles++]= path;
+}
+
+
+static char*
+try_file (const char* dir, size_t ldir, const char* name, int mode)
+{
+  char* file= (char*) malloc (ldir + strlen (name) + 2);
+  if (ldir) {
+    memcpy (file, dir, ldir);
+    file[ldir]= '/';
+    strcpy (file+ldir+1, name);
+  } else {
+    strcpy (file, name);
+  }
+  if (!access (file, mode)) return file;
+  free (file);
+  return NULL;
+}
+
+
+/* Look for NAME in DIR (if given), then in each $PATH directory.
+ * Returns a malloc'ed path, or NULL if not found.
+ */
+static char*
+find_file (const char* name, const char* dir, int mode)
+{
+  const char *path, *p, *q;
+  char* file;
+
+  if (strchr (name, '/')) return access (name, mode) ? NULL : strdup (name);
+  if (dir && (file= try_file (dir, strlen (dir), name, mode))) return file;
+  if (!(path= getenv ("PATH"))) return NULL;
+  for (p= path;; p= q+1) {
+    q= strchr (p, ':');
+    if ((file= try_file (p, q ? (size_t) (q-p) : strlen (p), name, mode))) return file;
+    if (!q) break;
+  }
+  return NULL;
+}
+
+
+static unsigned long
+get16 (const unsigned char* p)
+{
+  return p[0] | (p[1] << 8);
+}
+
+static unsigned long
+get32 (const unsigned char* p)
+{
+  return get16 (p) | (get16 (p+2) << 16);
+}
+
+
+/* Convert RVA to a file offset using the NSECT section headers at SECTS.
+ * Returns 0 if it is not in any section.
+ */
+static unsigned long
+rva_offset (int fd, unsigned long sects, unsigned long nsect, unsigned long rva)
+{
+  unsigned char sect[40];
+  unsigned long s, va;
+
+  for (s= 0; s<nsect; s++) {
+    if (pread (fd, sect, sizeof(sect), sects + sizeof(sect)*s) != sizeof(sect)) break;
+    va= get32 (sect+12);
+    if (rva >= va && rva < va + get32 (sect+8))
+      return rva - va + get32 (sect+20);
+  }
+  return 0;
+}
+
+
+/* Add the DLLs imported by the Windows executable open on FD */
+static void
+add_imports (struct prewarm* pw, int fd, const char* file)
+{
+  unsigned char hdr[24], opt[2], dir[8], desc[20];
+  unsigned long pe, nsect, lopt, sects, rva, off;
+  const char* slash;
+  char* exedir= NULL;
+
+  if (pread (fd, hdr, 4, 0x3c) != 4) return;
+  pe= get32 (hdr);
+  if (pread (fd, hdr, 24, pe) != 24 || memcmp (hdr, "PE\0\0", 4)) return;
+  nsect= get16 (hdr+6);
+  lopt=  get16 (hdr+20);
+  if (pread (fd, opt, 2, pe+24) != 2) return;
+  switch (get16 (opt)) {
+  case 0x10b: off=  96; break;  /* PE32 */
+  case 0x20b: off= 112; break;  /* PE32+ */
+  default:    return;
+  }
+  /* The import table is the second data directory */
+  if (off+16 > lopt || pread (fd, dir, 8, pe+24+off+8) != 8) return;
+  if (!(rva= get32 (dir))) return;
+  sects= pe + 24 + lopt;
+
+  if ((slash= strrchr (file, '/'))) {
+    exedir= strdup (file);
+    exedir[slash-file]= '\0';
+  }
+
+  for (;; rva += sizeof(desc)) {
+    char dll[256], *path;
+    ssize_t n;
+
+    if (!(off= rva_offset (fd, sects, nsect, rva))) break;
+    if (pread (fd, desc, sizeof(desc), off) != sizeof(desc)) break;
+    if (!get32 (desc+12)) break;  /* null descriptor ends the table */
+    if (!(off= rva_offset (fd, sects, nsect, get32 (desc+12)))) break;
+    if ((n= pread (fd, dll, sizeof(dll)-1, off)) <= 0) break;
+    dll[n]= '\0';
+    if (!strncasecmp (dll, "api-ms-", 7) || !strncasecmp (dll, "ext-ms-", 7)) continue;
+    if (!(path= find_file (dll, exedir, R_OK))) continue;
+    if (strcasestr (path, "/windows/system32/")) {
+      free (path);  /* system DLLs are already in memory */
+      continue;
+    }
+    add_file (pw, path);
+  }
+  free (exedir);
+}
+
+
+/* Read FILE into the page cache, within the remaining budget */
+static void
+touch_file (struct prewarm* pw, const char* file)
+{
+  static char buf[65536];
+  ssize_t n;
+  int fd;
+
+  if ((fd= open (file, O_RDONLY)) < 0) return;
+  add_imports (pw, fd, file);
+#ifdef POSIX_FADV_WILLNEED
+  posix_fadvise (fd, 0, 0, POSIX_FADV_WILLNEED);
+#endif
+  while (pw->used < pw->budget) {
+    size_t want= pw->budget - pw->used;
+    if (want > sizeof(buf)) want= sizeof(buf);
+    if ((n= read (fd, buf, want)) <= 0) break;
+    pw->used += n;
+  }
+  close (fd);
+}
+
+
+static void*
+prewarm_thread (void* arg)
+{
+  struct prewarm* pw= (struct prewarm*) arg;
+  struct timespec t0, t1;
+  char now[20];
+  struct tm tm;
+  time_t t;
+  size_t i;
+
+#ifdef __CYGWIN__
+  if (!SetThreadPriority (GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN))
+    SetThreadPriority (GetCurrentThread(), THREAD_PRIORITY_IDLE);
+#endif
+  clock_gettime (CLOCK_MONOTONIC, &t0);
+  for (; pw->next < pw->nfiles && pw->used < pw->budget; pw->next++)
+    touch_file (pw, pw->files[pw->next]);
+  clock_gettime (CLOCK_MONOTONIC, &t1);
+
+  /* the same timestamp as cyglauncher's log, but reentrant as we are in our own thread */
+  t= time (NULL);
+  strftime (now, sizeof(now), "%Y/%m/%d-%H:%M:%S", localtime_r (&t, &tm));
+  fprintf (stderr, "%s: prewarmed %lu files, %.1f MB in %.2fs\n", now,
+           (unsigned long) pw->next, pw->used / 1048576.0,
+           (t1.tv_sec - t0.tv_sec) + 1e-9 * (t1.tv_nsec - t0.tv_nsec));
+  fflush (stderr);
+  for (i= 0; i<pw->nfiles; i++) free (pw->files[i]);
+  free (pw->files);
+  free (pw);
+  return NULL;
+}
+
+
+/* Start a low-priority thread to read the programs in PATHS (and the DLLs
+ * they use) into the page cache, reading at most BUDGET bytes.
+ * Takes ownership of the malloc'ed PATHS strings.
+ */
+int
+prewarm_start (char* paths[], size_t npaths, size_t budget)
+{
+  struct prewarm* pw;
+  pthread_attr_t attr;
+  pthread_t thread;
+  size_t i;
+  int err;
+
+  pw= (struct prewarm*) calloc (1, sizeof(*pw));
+  pw->budget= budget;
+  for (i= 0; i<npaths; i++) {
+    char* file= find_file (paths[i], NULL, X_OK);
+    if (file) add_file (pw, file);
+    free (paths[i]);
+  }
+  if (!pw->nfiles || !budget) {
+    free (pw->files);
+    free (pw);
+    return 0;
+  }
+
+  pthread_attr_init (&attr);
+  pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
+  err= pthread_create (&thread, &attr, prewarm_thread, pw);
+  pthread_attr_destroy (&attr);
+  if (err) {
+    for (i= 0; i<pw->nfiles; i++) free (pw->files[i]);
+    free (pw->files);
+    free (pw);
+    return 0;
+  }
+  return 1;
+}
@@ -0,0 +1,242 @@
+/*
+ * replay.c - re-issue requests from a trace file
+ *
+ * Copyright (c) 2004 by Tim Adye <T.J.Adye@rl.ac.uk>.
+ * Permission to use, copy, modify, and distribute this software and its
+ * documentation for any purpose and without fee is hereby granted,
+ * provided that the above copyright notice appears in all copies.
+ * If this software is included in another package, acknowledgement
+ * in the supporting documentation is requested, but not required.
+ * This software is provided "as is" without express or implied warranty.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+
+#include "argpack.h"
+#include "escstr.h"
+#include "trace.h"
+#include "replay.h"
+
+
+static unsigned long long
+now_ns (void)
+{
+  struct timespec t;
+  clock_gettime (CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+
+static int
+is_option (const char* word)
+{
+  return word[0] == '@' || word[0] == '{' || !strcmp (word, "!");
+}
+
+/* As substitute(), for a packed request */
+static char*
+substitute_packed (const char* data, size_t ldata, const char* standin, size_t* lnew)
+{
+  struct argpack pk;
+  const char* v;
+  size_t pos;
+  int type, done= 0;
+
+  argpack_init (&pk);
+  for (pos= ARGPACK_HDR; (type= argpack_next (data, ldata, &pos, &v)) > 0;) {
+    if (type == ARGPACK_ARG && !done && !is_option (v)) {
+      v= standin;
+      done= 1;
+    }
+    if (!argpack_add (&pk, type, v)) break;
+  }
+  if (type != 0) {  /* malformed, or out of memory: send it as it was */
+    free (pk.data);
+    *lnew= ldata;
+    if ((pk.data= (char*) malloc (ldata))) memcpy (pk.data, data, ldata);
+  } else {
+    *lnew= pk.ldata;
+  }
+  return pk.data;
+}
+
+/* Returns a copy of exec request DATA with the command replaced by STANDIN,
+ * leaving any request options and the command's arguments unchanged.
+ * *LNEW is set to the length of the copy.
+ */
+static char*
+substitute (const char* data, size_t ldata, const char* standin, size_t* lnew)
+{
+  char *argv[1024], *argbuf, *s;
+  const char* u;
+  size_t largbuf;
+  int argc, i;
+
+  if (argpack_is (data, ldata)) return substitute_packed (data, ldata, standin, lnew);
+  largbuf= strlen (data)+1;
+  argbuf= (char*) malloc (largbuf);
+  argc= splitargs (data, argv, sizeof(argv)/sizeof(argv[0]), argbuf, largbuf);
+  for (i= 0; i<argc; i++) {
+    if (!is_option (argv[i])) {
+      argv[i]= (char*) standin;
+      break;
+    }
+  }
+  u= (i<argc) ? escargs (argc, argv) : NULL;
+  s= strdup (u ? u : data);
+  free (argbuf);
+  *lnew= strlen (s)+1;
+  return s;
+}
+
+
+static int
+cmp_double (const void* a, const void* b)
+{
+  double da= *(const double*) a, db= *(const double*) b;
+  return (da > db) - (da < db);
+}
+
+static void
+summary (const char* label, double* v, size_t n)
+{
+  double sum= 0.0;
+  size_t i;
+  if (!n) return;
+  qsort (v, n, sizeof(double), cmp_double);
+  for (i= 0; i<n; i++) sum += v[i];
+  printf ("%-10s %9.3f %9.3f %9.3f %9.3f\n", label,
+          sum/n, v[n/2], v[(n*95)/100], v[n-1]);
+}
+
+
+/* Read the service times of the replayed requests (whose topics are
+ * TOPICS[0..N-1]) from the server's trace CF, which has been read up to
+ * the point where the replay started, into NEWSVC. Requests from other
+ * clients are skipped. Returns the number of replayed requests found.
+ */
+static size_t
+read_replayed (FILE* cf, char** topics, double* newsvc, size_t n)
+{
+  struct trace_record r;
+  size_t i= 0;
+
+  clearerr (cf);
+  while (i < n && trace_read (cf, &r) > 0) {
+    if (!strcmp (r.topic, topics[i])) newsvc[i++]= r.service * 1e-6;
+    free (r.data);
+  }
+  return i;
+}
+
+/* Re-issue the requests in trace FILE with SEND, keeping their original
+ * spacing (unless FAST), and with the commands replaced by STANDIN (if set).
+ * "exit" requests are skipped. Prints the round-trip latencies now.
+ * If COMPARE is set, it is the trace being written by the server we are
+ * replaying to (which should have no other clients), and the time it took
+ * to handle each request is compared with the time in FILE.
+ */
+int
+replay (const char* file, const char* compare, int fast, const char* standin, replaySendType send)
+{
+  struct trace_record r;
+  unsigned long long t0= 0, start= 0, t;
+  double *orig= NULL, *lat= NULL, *newsvc= NULL, *diff= NULL;
+  char** topics= NULL;
+  size_t n= 0, maxn= 0, skipped= 0, failed= 0, found= 0, i;
+  FILE *f, *cf= NULL;
+  int st;
+
+  if (!(f= trace_open (file))) {
+    fprintf (stderr, "%s: not a cyglauncher trace file\n", file);
+    return 0;
+  }
+  if (compare) {
+    if (!(cf= trace_open (compare))) {
+      fprintf (stderr, "%s: not a cyglauncher trace file\n", compare);
+      fclose (f);
+      return 0;
+    }
+    while (trace_read (cf, &r) > 0) free (r.data);  /* requests before the replay */
+  }
+  while ((st= trace_read (f, &r)) > 0) {
+    char* data= r.data;
+    size_t ldata;
+    if (!strcmp (r.topic, "exit")) {
+      skipped++;
+      free (r.data);
+      continue;
+    }
+    if (!start) {
+      t0= r.time;
+      start= now_ns();
+    } else if (!fast && r.time > t0) {
+      unsigned long long due= start + (r.time - t0);
+      if ((t= now_ns()) < due) {
+        struct timespec ts;
+        ts.tv_sec=  (due-t) / 1000000000ULL;
+        ts.tv_nsec= (due-t) % 1000000000ULL;
+        while (nanosleep (&ts, &ts) && errno == EINTR) ;
+      }
+    }
+    /* text requests are sent with their '\0', which the ring doesn't record */
+    ldata= argpack_is (r.data, r.ldata) ? r.ldata : strlen (r.data)+1;
+    if (standin && !strcmp (r.topic, "exec")) data= substitute (r.data, ldata, standin, &ldata);
+
+    if (n >= maxn) {
+      maxn= maxn ? 2*maxn : 1024;
+      orig= (double*) realloc (orig, maxn * sizeof(double));
+      lat=  (double*) realloc (lat,  maxn * sizeof(double));
+      topics= (char**) realloc (topics, maxn * sizeof(char*));
+    }
+    t= now_ns();
+    if (!data || !send (r.topic, data, ldata)) failed++;
+    lat[n]=  (now_ns() - t) * 1e-6;
+    orig[n]= r.service * 1e-6;
+    topics[n]= strdup (r.topic);
+    n++;
+
+    if (data != r.data) free (data);
+    free (r.data);
+  }
+  fclose (f);
+  if (st < 0) fprintf (stderr, "%s: trace file is truncated\n", file);
+
+  printf ("%lu requests replayed in %.3fs, %lu failed, %lu skipped\n",
+          (unsigned long) n, start ? (now_ns() - start) * 1e-9 : 0.0,
+          (unsigned long) failed, (unsigned long) skipped);
+  if (cf && n) {
+    newsvc= (double*) malloc (n * sizeof(double));
+    diff=   (double*) malloc (n * sizeof(double));
+    found= read_replayed (cf, topics, newsvc, n);
+    if (found < n)
+      fprintf (stderr, "%s: only %lu of the replayed requests were found\n", compare, (unsigned long) found);
+    printf ("%6s %-8s %9s %9s %9s\n", "#", "topic", "recorded", "replayed", "diff (ms)");
+    for (i= 0; i<found; i++) {
+      diff[i]= newsvc[i] - orig[i];
+      printf ("%6lu %-8s %9.3f %9.3f %+9.3f\n", (unsigned long) i+1, topics[i], orig[i], newsvc[i], diff[i]);
+    }
+  }
+  if (n) {
+    printf ("%-10s %9s %9s %9s %9s\n", "time (ms)", "mean", "median", "95%", "max");
+    if (found) {
+      /* the server's own handling times, for requests found in both traces */
+      summary ("recorded", orig,   found);
+      summary ("replayed", newsvc, found);
+      summary ("diff",     diff,   found);
+    }
+    summary ("round trip", lat, n);
+  }
+  if (cf) fclose (cf);
+  for (i= 0; i<n; i++) free (topics[i]);
+  free (topics);
+  free (orig);
+  free (lat);
+  free (newsvc);
+  free (diff);
+  return st >= 0;
+}
@@ -0,0 +1,20 @@
+/*
+ * replay.h - re-issue requests from a trace file
+ *
+ * Copyright (c) 2004 by Tim Adye <T.J.Adye@rl.ac.uk>.
+ * Permission to use, copy, modify, and distribute this software and its
+ * documentation for any purpose and without fee is hereby granted,
+ * provided that the above copyright notice appears in all copies.
+ * If this software is included in another package, acknowledgement
+ * in the supporting documentation is requested, but not required.
+ * This software is provided "as is" without express or implied warranty.
+ */
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+typedef int (*replaySendType)(const char* topic, const char* data, size_t ldata);
+
+extern int replay(const char* file, const char* compare, int fast, const char* standin, replaySendType send);
+
+#endif /* REPLAY_H */
@@ -0,0 +1,400 @@
+/*
+ * shmring.c - shared-memory request ring
+ *
+ * Copyright (c) 2004 by Tim Adye <T.J.Adye@rl.ac.uk>.
+ * Permission to use, copy, modify, and distribute this software and its
+ * documentation for any purpose and without fee is hereby granted,
+ * provided that the above copyright notice appears in all copies.
+ * If this software is included in another package, acknowledgement
+ * in the supporting documentation is requested, but not required.
+ * This software is provided "as is" without express or implied warranty.
+ */
+
+/* Requests are passed in a ring of fixed-size slots in shared memory.
+ * Any number of clients can add requests; only the server removes them.
+ * Each slot has a sequence number, which says whether it is free for
+ * request number N (seq == N) or holds request N (seq == N+1). Clients
+ * claim a request number by incrementing the tail with compare-and-swap.
+ * The doorbell semaphore is only rung when the ring goes from empty to
+ * non-empty, so while the server is busy, requests are passed without any
+ * system calls. The server acknowledges request N by writing (N+1)<<8 and
+ * the handler's status to the slot's ack word, which the client polls.
+ * The client then frees the slot for request N+SHMRING_SLOTS. If a client
+ * dies before doing so, the slot is reclaimed by the next client to need it.
+ * If a client dies after claiming a request number but before filling in
+ * the slot, the server skips it after SHMRING_CLAIM_WAIT ms, and acks it
+ * with SHMRING_SKIPPED. A client that was just slow finds its slot already
+ * taken, and sees that ack.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "shmring.h"
+
+#define SHMRING_MAGIC 0x43595231UL  /* "CYR1" */
+#define SHMRING_CLAIM_WAIT 1000     /* ms before skipping a request that was never filled in */
+
+struct shmring_slot {
+  volatile unsigned long long seq;
+  volatile unsigned long long ack;     /* (request number+1)<<8 | status */
+  unsigned long ldata;
+  char data[SHMRING_DATA+1];
+};
+
+struct shmring_shared {
+  unsigned long magic;
+  pid_t server;
+  volatile unsigned long long tail;    /* next request number for clients */
+  volatile unsigned long long head;    /* next request number for server */
+  volatile long pending;               /* requests added but not yet handled */
+  struct shmring_slot slots[SHMRING_SLOTS];
+};
+
+struct shmring {
+  struct shmring_shared* shm;
+  sem_t* bell;
+  char* name;
+  int owner;
+  volatile int stopping;      /* set by shmring_stop */
+};
+
+
+/* Name of the per-user ring for cyglauncher INSTANCE (NULL for the default) */
+const char*
+shmring_name (const char* instance)
+{
+  static char buf[128];
+  if (instance)
+    snprintf (buf, sizeof(buf), "/cyglaunch-%lu-%s", (unsigned long) getuid(), instance);
+  else
+    snprintf (buf, sizeof(buf), "/cyglaunch-%lu",    (unsigned long) getuid());
+  return buf;
+}
+
+
+static char*
+bell_name (const char* name)
+{
+  char* s= (char*) malloc (strlen (name) + 6);
+  strcpy (s, name);
+  strcat (s, "-bell");
+  return s;
+}
+
+
+static struct shmring*
+shmring_map (const char* name, int create)
+{
+  struct shmring* ring;
+  struct stat st;
+  char* bell;
+  void* p;
+  int fd;
+
+  fd= shm_open (name, create ? (O_RDWR | O_CREAT | O_EXCL) : O_RDWR, 0600);
+  if (fd < 0) return NULL;
+  if (create && ftruncate (fd, sizeof(struct shmring_shared))) {
+    close (fd);
+    shm_unlink (name);
+    return NULL;
+  }
+  if (!create && (fstat (fd, &st) || st.st_size < (off_t) sizeof(struct shmring_shared))) {
+    close (fd);
+    errno= ENOENT;   /* its server hasn't set it up yet */
+    return NULL;
+  }
+  p= mmap (NULL, sizeof(struct shmring_shared), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close (fd);
+  if (p == MAP_FAILED) {
+    if (create) shm_unlink (name);
+    return NULL;
+  }
+
+  ring= (struct shmring*) calloc (1, sizeof(*ring));
+  ring->shm= (struct shmring_shared*) p;
+  ring->name= strdup (name);
+  ring->owner= create;
+  bell= bell_name (name);
+  if (create) sem_unlink (bell);  /* left by a dead server: we own the name now */
+  ring->bell= sem_open (bell, create ? (O_CREAT | O_EXCL) : 0, 0600, 0);
+  free (bell);
+  if (ring->bell == SEM_FAILED) {
+    ring->bell= NULL;
+    shmring_close (ring);
+    return NULL;
+  }
+  return ring;
+}
+
+
+/* Is the ring's server still running? */
+static int
+server_alive (struct shmring_shared* shm)
+{
+  return shm->server > 0 && (!kill (shm->server, 0) || errno == EPERM);
+}
+
+
+/* Create the ring NAME for this (server) process. Fails with EEXIST if
+ * another server is still using it; a ring left by a dead server is
+ * replaced.
+ */
+struct shmring*
+shmring_create (const char* name)
+{
+  struct shmring *ring, *old;
+  unsigned long i;
+
+  if (!(ring= shmring_map (name, 1))) {
+    if (errno != EEXIST) return NULL;
+    if ((old= shmring_map (name, 0))) {
+      int alive= server_alive (old->shm);
+      shmring_close (old);
+      if (alive) {
+        errno= EEXIST;
+        return NULL;
+      }
+    }
+    shm_unlink (name);
+    if (!(ring= shmring_map (name, 1))) return NULL;
+  }
+  ring->shm->server= getpid();
+  for (i= 0; i<SHMRING_SLOTS; i++) ring->shm->slots[i].seq= i;
+  __sync_synchronize();
+  ring->shm->magic= SHMRING_MAGIC;
+  return ring;
+}
+
+
+/* Connect to the ring NAME. Returns NULL if there is none, or its server
+ * has gone away.
+ */
+struct shmring*
+shmring_open (const char* name)
+{
+  struct shmring* ring;
+
+  if (!(ring= shmring_map (name, 0))) return NULL;
+  if (ring->shm->magic != SHMRING_MAGIC || !server_alive (ring->shm)) {
+    shmring_close (ring);
+    return NULL;
+  }
+  return ring;
+}
+
+
+/* Server: remove the ring's name, so no more clients can open it.
+ * Clients that already have it open can still send requests.
+ */
+void
+shmring_unlink (struct shmring* ring)
+{
+  char* bell;
+  if (!ring || !ring->owner) return;
+  bell= bell_name (ring->name);
+  ring->shm->magic= 0;
+  shm_unlink (ring->name);
+  sem_unlink (bell);
+  free (bell);
+  ring->owner= 0;
+}
+
+
+/* Server: make shmring_wait return 0, so the thread calling it can be
+ * stopped before the ring is closed.
+ */
+void
+shmring_stop (struct shmring* ring)
+{
+  if (!ring) return;
+  ring->stopping= 1;
+  sem_post (ring->bell);
+}
+
+
+void
+shmring_close (struct shmring* ring)
+{
+  if (!ring) return;
+  shmring_unlink (ring);
+  if (ring->bell) sem_close (ring->bell);
+  munmap ((void*) ring->shm, sizeof(struct shmring_shared));
+  free (ring->name);
+  free (ring);
+}
+
+
+/* Wait a little longer each time we are called */
+static void
+backoff (unsigned long* n)
+{
+  if (*n < 100) {
+    sched_yield();
+  } else {
+    struct timespec ts;
+    ts.tv_sec= 0;
+    ts.tv_nsec= (*n < 1000 ? *n : 1000) * 1000L;
+    nanosleep (&ts, NULL);
+  }
+  (*n)++;
+}
+
+static long
+elapsed_ms (const struct timespec* t0)
+{
+  struct timespec t;
+  clock_gettime (CLOCK_MONOTONIC, &t);
+  return (t.tv_sec - t0->tv_sec) * 1000L + (t.tv_nsec - t0->tv_nsec) / 1000000L;
+}
+
+
+/* Send a request and wait up to TIMEOUT ms for it to be handled.
+ * Returns the handler's status (0-255), or -1 if the request could not be
+ * delivered or was not acknowledged in time.
+ */
+int
+shmring_send (struct shmring* ring, const void* data, size_t ldata, int timeout)
+{
+  struct shmring_shared* shm= ring->shm;
+  struct shmring_slot* slot;
+  unsigned long long pos, ack;
+  unsigned long n= 0;
+  struct timespec t0;
+
+  if (ldata > SHMRING_DATA) {
+    errno= E2BIG;
+    return -1;
+  }
+  clock_gettime (CLOCK_MONOTONIC, &t0);
+  for (;;) {
+    long long diff;
+    pos= shm->tail;
+    slot= &shm->slots[pos & (SHMRING_SLOTS-1)];
+    diff= (long long) (slot->seq - pos);
+    if (diff == 0) {
+      if (__sync_bool_compare_and_swap (&shm->tail, pos, pos+1)) break;
+    } else if (diff < 0) {      /* ring is full */
+      long ms= elapsed_ms (&t0);
+      unsigned long long seq= slot->seq;
+      if (ms > timeout || kill (shm->server, 0)) {
+        errno= ETIMEDOUT;
+        return -1;
+      }
+      /* Reclaim a slot that was acknowledged long ago but never freed */
+      if (ms > 1000 && (slot->ack >> 8) == seq)
+        __sync_bool_compare_and_swap (&slot->seq, seq, seq-1+SHMRING_SLOTS);
+      backoff (&n);
+    }
+  }
+
+  memcpy (slot->data, data, ldata);
+  slot->data[ldata]= '\0';
+  slot->ldata= ldata;
+  __sync_synchronize();
+  /* fails if the server took too long and skipped us: it will ack SHMRING_SKIPPED */
+  if (__sync_bool_compare_and_swap (&slot->seq, pos, pos+1) &&
+      __sync_fetch_and_add (&shm->pending, 1) == 0)
+    sem_post (ring->bell);
+
+  for (n= 0;; ) {
+    ack= slot->ack;
+    if ((ack >> 8) == pos+1) break;
+    if ((n & 255) == 255 && (elapsed_ms (&t0) > timeout || kill (shm->server, 0))) {
+      errno= ETIMEDOUT;
+      return -1;   /* the slot is reclaimed once it has been acknowledged */
+    }
+    backoff (&n);
+  }
+  __sync_bool_compare_and_swap (&slot->seq, pos+1, pos+SHMRING_SLOTS);
+  if ((ack & 0xff) == SHMRING_SKIPPED) {
+    errno= EAGAIN;   /* not handled, so can be sent another way */
+    return -1;
+  }
+  return (int) (ack & 0xff);
+}
+
+
+/* Number of requests sent but not yet handled by the server */
+size_t
+shmring_queued (struct shmring* ring)
+{
+  struct shmring_shared* shm= ring->shm;
+  return (size_t) (shm->tail - shm->head);
+}
+
+
+/* Server: wait until the next request is ready. Returns 0 on error, or
+ * once shmring_stop has been called.
+ */
+int
+shmring_wait (struct shmring* ring)
+{
+  struct shmring_shared* shm= ring->shm;
+  unsigned long long stuck= 0;
+  unsigned long n= 0;
+  struct timespec t0;
+
+  while (!ring->stopping) {
+    unsigned long long pos= shm->head;
+    struct shmring_slot* slot= &shm->slots[pos & (SHMRING_SLOTS-1)];
+    if (slot->seq == pos+1) return 1;
+    if (shm->pending > 0) {
+      /* a later request is ready, so a client is part way through adding
+       * this one, or died doing so
+       */
+      if (stuck != pos+1) {
+        stuck= pos+1;
+        clock_gettime (CLOCK_MONOTONIC, &t0);
+      } else if (elapsed_ms (&t0) > SHMRING_CLAIM_WAIT &&
+                 __sync_bool_compare_and_swap (&slot->seq, pos, pos+1)) {
+        slot->ack= ((pos+1) << 8) | SHMRING_SKIPPED;
+        shm->head= pos+1;
+        continue;
+      }
+      backoff (&n);
+    } else if (sem_wait (ring->bell) && errno != EINTR) {
+      return 0;
+    }
+  }
+  return 0;
+}
+
+
+/* Server: pass all waiting requests to HANDLER, in order.
+ * Returns the number handled.
+ */
+size_t
+shmring_drain (struct shmring* ring, shmringHandlerType handler)
+{
+  struct shmring_shared* shm= ring->shm;
+  struct shmring_slot* slot;
+  unsigned long long pos;
+  size_t n= 0;
+  int status;
+
+  for (;;) {
+    pos= shm->head;
+    slot= &shm->slots[pos & (SHMRING_SLOTS-1)];
+    if (slot->seq != pos+1) break;
+    __sync_synchronize();
+    slot->data[SHMRING_DATA]= '\0';
+    status= handler (slot->data, slot->ldata < SHMRING_DATA ? slot->ldata : SHMRING_DATA);
+    __sync_synchronize();
+    slot->ack= ((pos+1) << 8) | (status & 0xff);
+    shm->head= pos+1;
+    __sync_fetch_and_sub (&shm->pending, 1);
+    n++;
+  }
+  return n;
+}
@@ -0,0 +1,38 @@
+/*
+ * shmring.h - shared-memory request ring
+ *
+ * Copyright (c) 2004 by Tim Adye <T.J.Adye@rl.ac.uk>.
+ * Permission to use, copy, modify, and distribute this software and its
+ * documentation for any purpose and without fee is hereby granted,
+ * provided that the above copyright notice appears in all copies.
+ * If this software is included in another package, acknowledgement
+ * in the supporting documentation is requested, but not required.
+ * This software is provided "as is" without express or implied warranty.
+ */
+
+#ifndef SHMRING_H
+#define SHMRING_H
+
+#define SHMRING_SLOTS 64      /* must be a power of 2 */
+#define SHMRING_DATA  4096    /* maximum request size */
+
+/* Handler status, returned by shmring_send: 0 if the request failed */
+#define SHMRING_OK    1
+#define SHMRING_ERRNO 0x80    /* | errno, if the command could not be run */
+#define SHMRING_SKIPPED 0x7f  /* ack only: the server gave up waiting for the request */
+
+struct shmring;
+typedef int (*shmringHandlerType)(const void *data, unsigned long ldata);
+
+extern const char*     shmring_name(const char* instance);
+extern struct shmring* shmring_create(const char* name);
+extern struct shmring* shmring_open(const char* name);
+extern void            shmring_unlink(struct shmring* ring);
+extern void            shmring_stop(struct shmring* ring);
+extern void            shmring_close(struct shmring* ring);
+extern int             shmring_send(struct shmring* ring, const void* data, size_t ldata, int timeout);
+extern size_t          shmring_queued(struct shmring* ring);
+extern int             shmring_wait(struct shmring* ring);
+extern size_t          shmring_drain(struct shmring* ring, shmringHandlerType handler);
+
+#endif /* SHMRING_H */
@@ -0,0 +1,122 @@
+/*
+ * trace.c - request trace files
+ *
+ * Copyright (c) 2004 by Tim Adye <T.J.Adye@rl.ac.uk>.
+ * Permission to use, copy, modify, and distribute this software and its
+ * documentation for any purpose and without fee is hereby granted,
+ * provided that the above copyright notice appears in all copies.
+ * If this software is included in another package, acknowledgement
+ * in the supporting documentation is requested, but not required.
+ * This software is provided "as is" without express or implied warranty.
+ */
+
+/* A trace file starts with trace_magic, followed by one record per request:
+ *   8 bytes  time received (ns)
+ *   8 bytes  service time (ns)
+ *   1 byte   topic length
+ *   4 bytes  data length
+ *   topic, then data (exactly as passed to the topic handler)
+ * All numbers are little-endian.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <fcntl.h>
+
+#include "trace.h"
+
+static const char trace_magic[8]= "CYGLTRC1";
+
+
+static void
+put64 (unsigned char* p, unsigned long long v)
+{
+  int i;
+  for (i= 0; i<8; i++, v >>= 8) p[i]= v & 0xff;
+}
+
+static unsigned long long
+get64 (const unsigned char* p, int n)
+{
+  unsigned long long v= 0;
+  while (n--) v= (v << 8) | p[n];
+  return v;
+}
+
+
+FILE*
+trace_create (const char* file)
+{
+  FILE* f;
+  if (!(f= fopen (file, "wb"))) return NULL;
+  fcntl (fileno (f), F_SETFD, FD_CLOEXEC);  /* not for the commands we start */
+  if (fwrite (trace_magic, sizeof(trace_magic), 1, f) != 1 || fflush (f)) {
+    fclose (f);
+    return NULL;
+  }
+  return f;
+}
+
+
+/* Append a record, and flush it so the trace is complete if we are killed */
+int
+trace_write (FILE* f, const struct trace_record* r)
+{
+  unsigned char hdr[21];
+  size_t ltopic= strlen (r->topic);
+
+  if (ltopic > 255) ltopic= 255;
+  put64 (hdr,    r->time);
+  put64 (hdr+8,  r->service);
+  hdr[16]= ltopic;
+  hdr[17]=  r->ldata        & 0xff;
+  hdr[18]= (r->ldata >>  8) & 0xff;
+  hdr[19]= (r->ldata >> 16) & 0xff;
+  hdr[20]= (r->ldata >> 24) & 0xff;
+  if (fwrite (hdr, sizeof(hdr), 1, f) != 1) return 0;
+  if (ltopic && fwrite (r->topic, ltopic, 1, f) != 1) return 0;
+  if (r->ldata && fwrite (r->data, r->ldata, 1, f) != 1) return 0;
+  return !fflush (f);
+}
+
+
+FILE*
+trace_open (const char* file)
+{
+  char magic[sizeof(trace_magic)];
+  FILE* f;
+  if (!(f= fopen (file, "rb"))) return NULL;
+  if (fread (magic, sizeof(magic), 1, f) != 1 || memcmp (magic, trace_magic, sizeof(magic))) {
+    fclose (f);
+    return NULL;
+  }
+  return f;
+}
+
+
+/* Read the next record into R, with R->data malloc'ed.
+ * Returns 1 if OK, 0 at end of file, or -1 if the file is corrupt.
+ */
+int
+trace_read (FILE* f, struct trace_record* r)
+{
+  unsigned char hdr[21];
+  size_t ltopic;
+
+  if (fread (hdr, sizeof(hdr), 1, f) != 1) return feof (f) ? 0 : -1;
+  r->time=    get64 (hdr,    8);
+  r->service= get64 (hdr+8,  8);
+  ltopic=     hdr[16];
+  r->ldata=   get64 (hdr+17, 4);
+  if (ltopic && fread (r->topic, ltopic, 1, f) != 1) return -1;
+  r->topic[ltopic]= '\0';
+  if (!(r->data= (char*) malloc (r->ldata+1))) return -1;
+  if (r->ldata && fread (r->data, r->ldata, 1, f) != 1) {
+    free (r->data);
+    r->data= NULL;
+    return -1;
+  }
+  r->data[r->ldata]= '\0';
+  return 1;
+}
@@ -0,0 +1,30 @@
+/*
+ * trace.h - request trace files
+ *
+ * Copyright (c) 2004 by Tim Adye <T.J.Adye@rl.ac.uk>.
+ * Permission to use, copy, modify, and distribute this software and its
+ * documentation for any purpose and without fee is hereby granted,
+ * provided that the above copyright notice appears in all copies.
+ * If this software is included in another package, acknowledgement
+ * in the supporting documentation is requested, but not required.
+ * This software is provided "as is" without express or implied warranty.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+/* One request, as received by cyglauncher */
+struct trace_record {
+  unsigned long long time;      /* when received, ns (CLOCK_MONOTONIC) */
+  unsigned long long service;   /* time taken to handle it, ns */
+  char topic[256];
+  unsigned long ldata;
+  char* data;                   /* ldata bytes, plus a terminating '\0' */
+};
+
+extern FILE* trace_create(const char* file);
+extern int   trace_write(FILE* f, const struct trace_record* r);
+extern FILE* trace_open(const char* file);
+extern int   trace_read(FILE* f, struct trace_record* r);
+
+#endif /* TRACE_H */